@@ -26,6 +26,7 @@
 #include <algorithm>
 #include <type_traits>
 #include <iostream>
+#include <bitset>
 
 namespace gcpp {
 
@@ -64,6 +65,12 @@ namespace gcpp {
 			return (bit_count + bits_per_unit - 1) / bits_per_unit;
 		}
 
+		//  Return a mask that selects the bits in the last unit that are in use
+		//
+		unit last_unit_mask() const noexcept {
+			return size % bits_per_unit == 0 ? all_bits(true) : bit_mask(size) - 1;
+		}
+
 		//  Get the unit that contains the bit at position
 		//
 		unit& bit_unit(int at) noexcept {
@@ -98,7 +105,17 @@ namespace gcpp {
 		bool all_false() const noexcept {
 			auto all_false = [](unit u) { return u == unit(0); };
 			return std::all_of(bits.get(), bits.get() + unit_count(size) - 1, all_false)
-				&& all_false(*(bits.get() + unit_count(size) - 1) & (bit_mask(size) - 1));
+				&& all_false(*(bits.get() + unit_count(size) - 1) & last_unit_mask());
+		}
+
+		//	Count the bits that are true
+		//
+		int count() const noexcept {
+			auto count = [](unit u) { return static_cast<int>(std::bitset<bits_per_unit>(u).count()); };
+			auto ret = count(*(bits.get() + unit_count(size) - 1) & last_unit_mask());
+			std::for_each(bits.get(), bits.get() + unit_count(size) - 1,
+				[&](unit u) { ret += count(u); });
+			return ret;
 		}
 
 		//	Set flag value at position
@@ -187,7 +204,7 @@ namespace gcpp {
 		//	Find next flag in positions [from,to) that is set to value
 		//	Returns index of next flag that is set to value, or "to" if none was found
 		//
-		int find_next(int from, int to, bool value) noexcept {
+		int find_next(int from, int to, bool value) const noexcept {
 			Expects(0 <= from && from <= to && to <= size && "bitflags find_next() out of range");
 
 			if (from == to) {
@@ -41,16 +41,22 @@ namespace gcpp {
 	template <class T>
 	class deferred_allocator
 	{
-		deferred_heap& h;
+		//	the heap's handle rather than the heap, so that the containers
+		//	using this allocator follow their objects when the heap is adopted
+		deferred_heap* const* h;
+
+		template <class U>
+		friend class deferred_allocator;
+
 	public:
 
 		deferred_heap& heap() const {
-			return h;
+			return **h;
 		}
 
 		using value_type         = T;
-		using pointer            = deferred_ptr<value_type>;
-		using const_pointer      = deferred_ptr<const value_type>;
+		using pointer            = array_deferred_ptr<value_type>;
+		using const_pointer      = array_deferred_ptr<const value_type>;
 		using void_pointer       = deferred_ptr<void>;
 		using const_void_pointer = deferred_ptr<const void>;
 		using difference_type    = ptrdiff_t;
@@ -63,23 +69,28 @@ namespace gcpp {
 		};
 
 		deferred_allocator(deferred_heap& h_) noexcept 
-			: h{ h_ }
+			: h{ h_.handle() }
 		{
 		}
 
 		template <class U> 
 		deferred_allocator(deferred_allocator<U> const& that) noexcept
-			: h{ that.heap() }
+			: h{ that.h }
 		{
 		}
 
 		pointer allocate(size_type n) 
 		{
-			return h.allocate<value_type>(n);
+			return{ (*h)->allocate<value_type>(gsl::narrow_cast<int>(n)), n };
 		}
 
-		void deallocate(pointer, size_type) noexcept
-		{ 
+		//	The container may still refer to p until this returns, so the heap
+		//	releases the storage at its next allocation if nothing refers to
+		//	it by then, else a collection reclaims it
+		//
+		void deallocate(pointer p, size_type) noexcept
+		{
+			(*h)->release_later(p.get());
 		}
 
 		pointer allocate(size_type n, const_void_pointer) 
@@ -90,13 +101,13 @@ namespace gcpp {
 		template <class U, class ...Args>
 		void construct(U* p, Args&& ...args) 
 		{
-			h.construct<U>(p, std::forward<Args>(args)...);
+			(*h)->construct<U>(p, std::forward<Args>(args)...);
 		}
 
 		template <class U>
 		void destroy(U* p) noexcept
 		{
-			h.destroy<U>(p);
+			(*h)->destroy<U>(p);
 		}
 
 		size_type max_size() const noexcept 
@@ -118,7 +129,7 @@ namespace gcpp {
 	template <class T, class U>
 	inline bool operator==(deferred_allocator<T> const& a, deferred_allocator<U> const& b) noexcept 
 	{
-		return &a.h == &b.h;
+		return &a.heap() == &b.heap();
 	}
 
 	template <class T, class U>
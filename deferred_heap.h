@@ -23,71 +23,251 @@
 
 #include <vector>
 #include <list>
+#include <deque>
+#include <map>
 #include <utility>
 #include <unordered_set>
 #include <algorithm>
 #include <type_traits>
 #include <memory>
+#include <chrono>
+#include <limits>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
 
 namespace gcpp {
 	template<class T> class deferred_ptr;
+	template<class T> class array_deferred_ptr;
+	template<class T> class deferred_root_vector;
 
-	//  Copy and remove elements that satisfy pred from [first, last) into out.
-	template<class BidirectionalIterator, class OutputIterator, class Predicate>
-	std::pair<BidirectionalIterator, OutputIterator>
-	unstable_remove_copy_if(BidirectionalIterator first, BidirectionalIterator last,
-		OutputIterator out, Predicate pred)
-	{
-		for (;;) {
-			first = std::find_if(first, last, pred);
-			if (first == last) {
-				break;
-			}
-			// *first satisfies pred. Move it out of the sequence...
-			*out++ = std::move(*first);
-			// ...and replace with the last element of the sequence.
-			if (first == --last) {
-				break;
-			}
-			*first = std::move(*last);
-		}
-		return {first, out};
-	}
+	//	is_relocatable<T>: Specialize as std::true_type to let deferred_heap::compact
+	//	move T objects to another address with T's move constructor (followed by
+	//	destroying the original), and then update every deferred_ptr to them.
+	//
+	template<class T>
+	struct is_relocatable : std::false_type { };
+
+	template<class T>
+	struct is_relocatable<deferred_ptr<T>> : std::true_type { };
+
+	//	is_pointer_free<T>: Whether T objects never contain deferred_ptrs, so that
+	//	deferred_heap can keep them on separate pages that marking never scans.
+	//	A trivially copyable type can't contain a deferred_ptr, so it always
+	//	qualifies; specialize as std::true_type for other such types (e.g., a
+	//	std::string). Allocating a deferred_ptr inside one is an error.
+	//
+	template<class T>
+	struct is_pointer_free : std::is_trivially_copyable<T> { };
+
+	//	deferred_layout<T>: Specialize as std::true_type, with a static offsets()
+	//	that lists the offsets of all of T's deferred_ptr members, to let
+	//	deferred_heap find the deferred_ptrs in T objects by walking the objects
+	//	rather than by registering each deferred_ptr. T objects then go on
+	//	pages of their own. For example:
+	//
+	//		template<> struct gcpp::deferred_layout<node> : std::true_type {
+	//			static std::vector<std::size_t> offsets() {
+	//				return{ offsetof(node, next), offsetof(node, other) };
+	//			}
+	//		};
+	//
+	template<class T>
+	struct deferred_layout : std::false_type { };
 
 	//  destructor contains a pointer and type-correct-but-erased dtor call.
-	//  (Happily, a noncapturing lambda decays to a function pointer, which
-	//	will make these both easy to construct and cheap to store without
-	//	resorting to the usual type-erasure machinery.)
+	//  (Happily, a function template specialization or a noncapturing lambda
+	//	decays to a function pointer, which makes these both easy to construct
+	//	and cheap to store without resorting to the usual type-erasure
+	//	machinery.) For a relocatable type it also contains an erased
+	//	relocation, else null.
+	//
+	//	One destructor covers an array of count objects stride bytes apart,
+	//	so that a whole array (or a run of adjacent objects of the same type,
+	//	such as a container's elements) takes a single record, and its
+	//	destroy_n destroys them all in one typed loop.
+	//
+	//	Each page has its own destructors, kept in address order so that
+	//	the ones for objects in a given range are found by binary search.
 	//
 	class destructors {
 		struct destructor {
-			const void* p;
-			void(*destroy)(const void*);
+			const byte* p;
+			std::size_t count;
+			std::size_t stride;
+			void(*destroy_n)(const void*, std::size_t);
+			void(*relocate)(const void*, void*);
+
+			const byte* end() const noexcept { return p + count * stride; }
+
+			//	whether that continues this array
+			bool is_continued_by(const destructor& that) const noexcept {
+				return end() == that.p && stride == that.stride
+					&& destroy_n == that.destroy_n && relocate == that.relocate;
+			}
 		};
-		std::vector<destructor>	dtors;
+		std::vector<destructor>	dtors;		// ordered by p, not overlapping
+
+		template<class T>
+		static void destroy_n(const void* p, std::size_t n) {
+			for (auto t = static_cast<const T*>(p), end = t + n; t != end; ++t) {
+				t->~T();
+			}
+		}
+
+		template<class T>
+		static auto relocator(std::true_type) -> decltype(destructor::relocate) {
+			return [](const void* from, void* to) noexcept {
+				auto src = static_cast<T*>(const_cast<void*>(from));
+				::new (to) T(std::move(*src));
+				src->~T();
+			};
+		}
+
+		template<class T>
+		static auto relocator(std::false_type) -> decltype(destructor::relocate) {
+			return nullptr;
+		}
+
+		//	Return the first destructor for objects at or after p
+		//
+		std::vector<destructor>::iterator find(const byte* p) noexcept {
+			return std::lower_bound(dtors.begin(), dtors.end(), p,
+				[](const destructor& d, const byte* x) { return std::less<>{}(d.p, x); });
+		}
+
+		std::vector<destructor>::const_iterator find(const byte* p) const noexcept {
+			return std::lower_bound(dtors.begin(), dtors.end(), p,
+				[](const destructor& d, const byte* x) { return std::less<>{}(d.p, x); });
+		}
+
+		//	Insert d, merging it with its neighbors if it continues an array
+		//	or is continued by one
+		//
+		void insert(const destructor& d) {
+			auto at = find(d.p);
+			if (at != dtors.begin() && std::prev(at)->is_continued_by(d)) {
+				auto prev = std::prev(at);
+				prev->count += d.count;
+				if (at != dtors.end() && prev->is_continued_by(*at)) {
+					prev->count += at->count;
+					dtors.erase(at);
+				}
+			}
+			else if (at != dtors.end() && d.is_continued_by(*at)) {
+				at->p = d.p;
+				at->count += d.count;
+			}
+			else {
+				dtors.insert(at, d);
+			}
+		}
+
+		//	Take the destructors for objects whose addresses are in [lo,hi) out
+		//	of the registry, splitting any arrays that extend beyond it
+		//
+		void take(const byte* lo, const byte* hi, std::vector<destructor>& taken) {
+			auto first = find(lo);
+			if (first != dtors.begin() && std::less<>{}(lo, std::prev(first)->end())) {
+				--first;
+			}
+			auto last = find(hi);
+
+			std::vector<destructor> kept;
+			for (auto it = first; it != last; ++it) {
+				auto d = *it;
+				auto first_in = d.p < lo ? (lo - d.p + d.stride - 1) / d.stride : 0;
+				auto last_in  = std::min<std::size_t>(d.count, (hi - d.p + d.stride - 1) / d.stride);
+				if (first_in > 0) {
+					kept.push_back({ d.p, first_in, d.stride, d.destroy_n, d.relocate });
+				}
+				if (last_in > first_in) {
+					taken.push_back({ d.p + first_in * d.stride, last_in - first_in,
+									  d.stride, d.destroy_n, d.relocate });
+				}
+				if (d.count > last_in) {
+					kept.push_back({ d.p + last_in * d.stride, d.count - last_in,
+									 d.stride, d.destroy_n, d.relocate });
+				}
+			}
+			dtors.insert(dtors.erase(first, last), kept.begin(), kept.end());
+		}
 
 	public:
-		//	Store the destructor, if it's not trivial
+		//	A batch of destructors taken out of the registry to run together.
+		//	They run grouped by type, and in address order within each type,
+		//	so that one type's destructor code runs for all its objects in the
+		//	batch before the next type's. (Records aren't merged here: the
+		//	registry already merges adjacent ones, and separate allocations
+		//	are never adjacent, since each has its one-past-the-end location.)
+		//	A batch not run explicitly runs when it is destroyed, so that the
+		//	destructors run even if an exception is thrown.
+		//
+		class batch {
+			std::vector<destructor> to_destroy;
+			friend destructors;
+
+		public:
+			batch() = default;
+			batch(const batch&) = delete;
+			void operator=(const batch&) = delete;
+
+			~batch() {
+				run();
+			}
+
+			bool empty() const noexcept {
+				return to_destroy.empty();
+			}
+
+			void run() {
+				std::sort(to_destroy.begin(), to_destroy.end(), [](auto& a, auto& b) {
+					auto const by_type = std::less<decltype(a.destroy_n)>{};
+					return by_type(a.destroy_n, b.destroy_n)
+						|| (a.destroy_n == b.destroy_n && std::less<>{}(a.p, b.p));
+				});
+
+				//	for reentrancy safety, run from a local copy of the batch
+				auto ds = std::move(to_destroy);
+				to_destroy.clear();
+				for (auto& d : ds) {
+					//	=====================================================================
+					//  === BEGIN REENTRANCY-SAFE: ensure no in-progress use of private state
+					d.destroy_n(d.p, d.count);	// call objects' destructors
+					//  === END REENTRANCY-SAFE: reload any stored copies of private state
+					//	=====================================================================
+				}
+			}
+		};
+
+		//	Move the destructors for objects in range into b
+		//
+		void take(gsl::span<byte> range, batch& b) {
+			if (range.size() > 0) {
+				take(range.data(), range.data() + range.size(), b.to_destroy);
+			}
+		}
+
+		//	Store the destructor, if it's not trivial or the object is relocatable
 		//
 		template<class T>
 		void store(gsl::span<T> p) {
 			Expects(p.size() > 0
 				&& "no object to register for destruction");
-			if (!std::is_trivially_destructible<T>::value) {
-				//	For now we'll just store individual dtors even for arrays.
-				//	Future: To represent destructors for arrays more compactly,
-				//	have an array_destructor type as well with a count and size,
-				//  and when storing a new destructor check if it's immediately
-				//	after the end of an existing array destructor and if so just
-				//	++count, similarly when removing a destructor from the end,
-				//	or break apart an array_destructor when removing a
-				//	destructor from the middle
-				for (auto& t : p) {
-					dtors.push_back({
-						std::addressof(t),		// address
-						[](const void* x) { static_cast<const T*>(x)->~T(); }
-					});							// dtor to invoke
-				}
+			static_assert(!is_relocatable<T>::value || std::is_move_constructible<T>::value,
+				"a relocatable type must be move constructible");
+			if (!std::is_trivially_destructible<T>::value || is_relocatable<T>::value) {
+				insert({
+					(const byte*)p.data(),			// address
+					static_cast<std::size_t>(p.size()),
+					sizeof(T),
+					&destroy_n<T>,					// dtors to invoke
+					relocator<T>(is_relocatable<T>{})	// move to invoke, if relocatable
+				});
 			}
 		}
 
@@ -95,58 +275,151 @@ namespace gcpp {
 		//
 		template<class T>
 		bool is_stored(gsl::not_null<T*> p) const noexcept {
-			return std::is_trivially_destructible<T>::value
-				|| std::any_of(dtors.begin(), dtors.end(),
-					[=](auto x) { return x.p == p.get(); });
+			if (std::is_trivially_destructible<T>::value) {
+				return true;
+			}
+			auto x = (const byte*)p.get();
+			auto it = find(x + 1);
+			if (it == dtors.begin()) {
+				return false;
+			}
+			--it;
+			return std::less<>{}(x, it->end()) && (x - it->p) % it->stride == 0;
+		}
+
+		//	Inquire whether the objects in range can be relocated: there must be
+		//	at least one registered, and all of them must be relocatable
+		//
+		bool can_relocate(gsl::span<byte> range) const noexcept {
+			auto first = find(range.data()), last = find(range.data() + range.size());
+			return first != last
+				&& std::all_of(first, last, [](auto& d) { return d.relocate != nullptr; });
+		}
+
+		//	Relocate all the objects in range to the same offsets from to, and
+		//	move their destructors to dest, the registry of to's page
+		//
+		void relocate(gsl::span<byte> range, byte* to, destructors& dest) {
+			//	for reentrancy safety, take the affected destructors out while the
+			//	objects are moved, as in run()
+			auto const lo = range.data();
+			std::vector<destructor> moving;
+			take(lo, lo + range.size(), moving);
+
+			for (auto& d : moving) {
+				auto dest_p = to + (d.p - lo);
+				for (std::size_t i = 0; i < d.count; ++i) {
+					//	=====================================================================
+					//  === BEGIN REENTRANCY-SAFE: ensure no in-progress use of private state
+					d.relocate(d.p + i * d.stride, dest_p + i * d.stride);
+												// call object's move constructor and destructor
+					//  === END REENTRANCY-SAFE: reload any stored copies of private state
+					//	=====================================================================
+				}
+				d.p = dest_p;
+				dest.insert(d);
+			}
 		}
 
 		//	Run all the destructors and clear the list
 		//
 		void run_all() {
-			for (auto& d : dtors) {
-				d.destroy(d.p);	// call object's destructor
-			}
+			batch b;
+			b.to_destroy = std::move(dtors);
 			dtors.clear();
 		}
 
 		//	Run all the destructors for objects in [begin,end)
 		//
 		bool run(gsl::span<byte> range) {
-			if (range.size() == 0)
-				return false;
-
-			//	for reentrancy safety, we'll take a local copy of destructors to be run
-			//
-			//	move any destructors for objects in this range to a local list...
-			//
-			struct cleanup_t {
-				std::vector<destructor> to_destroy;
-
-				// ensure the locally saved destructors are run even if an exception is thrown
-				~cleanup_t() {
-					for (auto& d : to_destroy) {
-						//	=====================================================================
-						//  === BEGIN REENTRANCY-SAFE: ensure no in-progress use of private state
-						d.destroy(d.p);	// call object's destructor
-						//  === END REENTRANCY-SAFE: reload any stored copies of private state
-						//	=====================================================================
-					}
-				}
-			} cleanup;
+			batch b;
+			take(range, b);
+			return !b.to_destroy.empty();
+		}
 
-			auto const lo = &*range.begin(), hi = lo + range.size();
-			auto it = unstable_remove_copy_if(
-				dtors.begin(), dtors.end(), std::back_inserter(cleanup.to_destroy),
-				[=](destructor const& dtor) { return lo <= dtor.p && dtor.p < hi; }).first;
-			dtors.erase(it, dtors.end());
+		//	Return the number of registered objects, and the memory used to
+		//	register them
+		//
+		std::size_t size() const noexcept {
+			std::size_t n = 0;
+			for (auto& d : dtors) {
+				n += d.count;
+			}
+			return n;
+		}
 
-			return !cleanup.to_destroy.empty();
+		std::size_t bytes() const noexcept {
+			return dtors.capacity() * sizeof(destructor);
 		}
 
 		void debug_print() const;
 	};
 
 
+	//----------------------------------------------------------------------------
+	//
+	//	collect_budget - How much work one deferred_heap::collect_step (or
+	//	drain_finalizers) may do, by elapsed time and/or by number and size
+	//	of allocations marked, swept, or finalized. Each step does at least
+	//	one unit of work, so repeated steps always make progress.
+	//
+	//----------------------------------------------------------------------------
+
+	struct collect_budget {
+		using clock = std::chrono::steady_clock;
+
+		clock::duration time	= clock::duration::max();
+		std::size_t		objects = std::numeric_limits<std::size_t>::max();
+		std::size_t		bytes	= std::numeric_limits<std::size_t>::max();
+
+		static collect_budget unlimited() noexcept { return{}; }
+
+		template<class Rep, class Period>
+		static collect_budget of_time(std::chrono::duration<Rep, Period> d) noexcept {
+			collect_budget ret;
+			ret.time = std::chrono::duration_cast<clock::duration>(d);
+			return ret;
+		}
+
+		static collect_budget of_objects(std::size_t n) noexcept {
+			collect_budget ret;
+			ret.objects = n;
+			return ret;
+		}
+
+		static collect_budget of_bytes(std::size_t n) noexcept {
+			collect_budget ret;
+			ret.bytes = n;
+			return ret;
+		}
+	};
+
+
+	//----------------------------------------------------------------------------
+	//
+	//	deferred_heap_options - When a deferred_heap collects by itself.
+	//
+	//	growth_target	Pacer: collect when the heap has grown by this fraction
+	//					of the bytes that were live after the last cycle (like
+	//					GOGC = 100 * growth_target), or 0 to never pace
+	//	min_heap_bytes	Pacer: don't collect before the heap reaches this size
+	//	max_pause		Pacer: if nonzero, run paced cycles incrementally in
+	//					steps of at most this long, one per allocation
+	//	collect_before_expand	Collect whenever allocation would need a new page
+	//	retained_empty_bytes	Keep up to this much storage in empty pages for
+	//					reuse, instead of releasing every page a cycle empties
+	//
+	//----------------------------------------------------------------------------
+
+	struct deferred_heap_options {
+		double					  growth_target  = 0;
+		std::size_t				  min_heap_bytes = 4 * 1024 * 1024;
+		std::chrono::microseconds max_pause{ 0 };
+		bool					  collect_before_expand = false;
+		std::size_t				  retained_empty_bytes	= 0;
+	};
+
+
 	//----------------------------------------------------------------------------
 	//
 	//	The deferred heap produces deferred_ptr<T>s via make<T>.
@@ -158,7 +431,9 @@ namespace gcpp {
 		friend class deferred_ptr_void;
 
 		template<class T> friend class deferred_ptr;
+		template<class T> friend class array_deferred_ptr;
 		template<class T> friend class deferred_allocator;
+		template<class T> friend class deferred_root_vector;
 
 		//	Disable copy and move
 		deferred_heap(deferred_heap&)  = delete;
@@ -169,6 +444,35 @@ namespace gcpp {
 		void enregister(const deferred_ptr_void& p);
 		void deregister(const deferred_ptr_void& p);
 
+		//	Move from's registration to to, which is being move-constructed
+		//	from it. Invoked when moving a deferred_ptr.
+		void transfer(deferred_ptr_void& from, deferred_ptr_void& to) noexcept;
+
+		//	Set an attached deferred_ptr's value, with the write barrier.
+		void store(deferred_ptr_void& dp, void* p) noexcept;
+
+		//	A root range is an array of raw pointers into the heap that is
+		//	registered once as a whole, instead of as one root per pointer,
+		//	and that a collection scans as one contiguous array. It is the
+		//	storage of a deferred_root_vector. Like a deferred_ptr, it becomes
+		//	unattached (myheap == nullptr) when the heap is destroyed.
+		//
+		struct root_range {
+			deferred_heap*	   myheap;
+			std::vector<void*> ptrs;
+			std::size_t		   slot = 0;	// index in root_ranges
+		};
+
+		void enregister(root_range& r);
+		void deregister(root_range& r) noexcept;
+
+		//	Set, append, or remove (from index n on) pointers in a root range,
+		//	with the write barrier.
+		void store(root_range& r, std::size_t i, void* p) noexcept;
+		void push(root_range& r, void* p);
+		void truncate(root_range& r, std::size_t n) noexcept;
+		void reserve(root_range& r, std::size_t n);
+
 		//------------------------------------------------------------------------
 		//
 		//  deferred_ptr_void is the generic pointer type we use and track
@@ -206,11 +510,20 @@ namespace gcpp {
 			//	presentation from the central concepts that are actually important.
 			deferred_heap* myheap;
 			void* p;
+			std::atomic<std::size_t> slot{ 0 };	// this pointer's index in its registry,
+												// which is roots or its page's deferred_ptrs
 
 			friend deferred_heap;
 
 		protected:
-			void  set(void* p_) noexcept { p = p_; }
+			void  set(void* p_) noexcept {
+				if (myheap != nullptr) {
+					myheap->store(*this, p_);
+				}
+				else {
+					p = p_;
+				}
+			}
 
 			deferred_ptr_void(deferred_heap* heap = nullptr, void* p_ = nullptr)
 				: myheap{ heap }
@@ -233,6 +546,18 @@ namespace gcpp {
 				: deferred_ptr_void(that.myheap, that.p)
 			{ }
 
+			//	Moving leaves that unattached and null. If both pointers are in
+			//	the same registry, this pointer just takes over that's slot.
+			//
+			deferred_ptr_void(deferred_ptr_void&& that) noexcept
+				: myheap{ that.myheap }
+				, p{ that.p }
+			{
+				if (myheap != nullptr) {
+					myheap->transfer(that, *this);
+				}
+			}
+
 			deferred_ptr_void& operator=(const deferred_ptr_void& that) noexcept {
 				//	Allow assignment from an unattached null pointer
 				if (that.myheap == nullptr) {
@@ -244,16 +569,43 @@ namespace gcpp {
 				else {
 					Expects((myheap == nullptr || myheap == that.myheap)
 						&& "cannot assign deferred_ptrs into different deferred_heaps");
-					p = that.p;
 					if (myheap == nullptr) {
+						p = that.p;
 						that.myheap->enregister(*this);	// perform lazy attach
 						myheap = that.myheap;
 					}
+					else {
+						myheap->store(*this, that.p);
+					}
 				}
 
 				return *this;
 			}
 
+			deferred_ptr_void& operator=(deferred_ptr_void&& that) noexcept {
+				if (this != &that) {
+					*this = that;
+					that.reset();
+				}
+				return *this;
+			}
+
+			//	Swapping just exchanges the values, and each pointer keeps its
+			//	registration
+			//
+			void swap(deferred_ptr_void& that) noexcept {
+				if (myheap != nullptr && myheap == that.myheap) {
+					auto tmp = p;
+					myheap->store(*this, that.p);
+					myheap->store(that, tmp);
+				}
+				else {
+					deferred_ptr_void tmp{ std::move(*this) };
+					*this = std::move(that);
+					that = std::move(tmp);
+				}
+			}
+
 			//	detach is called from ~deferred_heap() when the heap is destroyed
 			//	before this pointer is destroyed
 			//
@@ -267,26 +619,66 @@ namespace gcpp {
 
 			void* get() const noexcept { return p; }
 
-			void  reset() noexcept { p = nullptr; /* leave myheap alone so we can assign again */ }
+			void  reset() noexcept {
+				//	leave myheap alone so we can assign again
+				if (myheap != nullptr) {
+					myheap->store(*this, nullptr);
+				}
+				else {
+					p = nullptr;
+				}
+			}
 		};
 
-		//	For non-roots (deferred_ptrs that are in the deferred heap), we'll additionally
-		//	store an int that we'll use for terminating marking within the deferred heap.
-		//  The level is the distance from some root -- not necessarily the smallest
-		//	distance from a root, just along whatever path we took during marking.
+		//	The deferred_ptrs in each object of a type with a deferred_layout
 		//
-		struct nonroot {
-			const deferred_ptr_void* p;
-			std::size_t level = 0;
-
-			nonroot(const deferred_ptr_void* p_) noexcept : p{ p_ } { }
+		struct type_layout {
+			std::size_t				 size;		// of one object
+			std::vector<std::size_t> offsets;	// of its deferred_ptrs
 		};
 
+		template<class T>
+		static const type_layout* layout_of(std::true_type) {
+			static const type_layout layout{ sizeof(T), deferred_layout<T>::offsets() };
+			return &layout;
+		}
+
+		template<class T>
+		static const type_layout* layout_of(std::false_type) {
+			return nullptr;
+		}
+
+		template<class T>
+		static const type_layout* layout_of() {
+			return layout_of<T>(deferred_layout<T>{});
+		}
+
 		struct dhpage {
 			gpage				 page;
 			bitflags		 	 live_starts;	// for tracing
-			std::vector<nonroot> deferred_ptrs;	// known deferred_ptrs in this page
+			std::vector<const deferred_ptr_void*>
+								 deferred_ptrs;	// known deferred_ptrs in this page
+			std::vector<const deferred_ptr_void*>
+								 traced_ptrs;	// the same, sorted by address, and
+			std::vector<int>	 traced_starts;	// the allocation each one is in
+			bool				 traced_stale = true;	// deferred_ptrs changed since sorting
+			std::unordered_set<const deferred_ptr_void*>
+								 incoming;		// deferred_ptrs on other pages that point here
+			destructors			 dtors;			// for objects in this page
 			deferred_heap*		 myheap;
+			std::size_t			 live_bytes = 0;	// estimated, see collect_regions
+			bool				 nursery    = false;	// holds young objects
+			bool				 condemned  = false;	// collected by this cycle
+			bool				 unswept    = false;	// marked, but lazily not yet swept
+			bitflags			 finalizing;		// unreachable, queued for finalization
+			bool				 owned      = false;	// a mutator's allocation page
+			bool				 pointer_free = false;	// holds only is_pointer_free objects
+			const type_layout*	 layout = nullptr;		// holds only objects of this type,
+														// whose deferred_ptrs aren't registered
+			bool				 conservative = false;	// scanned word by word, so its
+														// deferred_ptrs aren't registered
+														// or remembered
+			std::mutex			 mutex;				// guards the registries, in thread-safe mode
 
 			//	Construct a page tuned to hold Hint objects, big enough for
 			//	at least 1 + phi ~= 2.62 of these requests (but at least 8K),
@@ -300,7 +692,14 @@ namespace gcpp {
 						std::max<size_t>(sizeof(Hint), 4) }
 				, live_starts{ page.locations(), false }
 				, myheap{ heap }
+				, finalizing{ page.locations(), false }
 			{ }
+
+			//	Whether the page's deferred_ptrs are in its deferred_ptrs registry
+			//
+			bool registers_pointers() const noexcept {
+				return layout == nullptr && !conservative;
+			}
 		};
 
 
@@ -308,11 +707,243 @@ namespace gcpp {
 		//	Data: Storage and tracking information
 		//
 		std::list<dhpage>							 pages;
-		std::unordered_set<const deferred_ptr_void*> roots;	// outside deferred heap
-		destructors									 dtors;
+		std::map<const byte*, dhpage*>				 page_index;	// pages by address
+		std::vector<const deferred_ptr_void*>		 roots;	// outside deferred heap
+		std::vector<root_range*>					 root_ranges;
 
 		bool is_destroying = false;
-		bool collect_before_expand = false;	// Future: pull this into an options struct
+		bool is_resetting = false;
+		bool lazy_sweep = false;
+		bool conservative_scan = false;
+
+		//	A deferred_ptr on a conservative page holds this in its slot, so that
+		//	together with myheap it identifies the deferred_ptr when the page's
+		//	words are searched for deferred_ptrs to reset or detach
+		//
+		static constexpr std::size_t conservative_signature = std::size_t(0x9e3779b97f4a7c15ull);
+
+		//------------------------------------------------------------------------
+		//	Data: Options and pacing
+		//
+		deferred_heap_options options;
+		std::size_t			  allocated_since_cycle = 0;	// bytes
+		std::size_t			  live_after_cycle		= 0;	// bytes, estimated
+
+		void pace();
+
+		//------------------------------------------------------------------------
+		//	Data: Generational collection
+		//
+		//	In generational mode, new objects are allocated only on nursery pages.
+		//	A minor cycle collects just the nursery, tracing from the roots plus
+		//	the deferred_ptrs on old pages that point into the nursery (which
+		//	the nursery pages' incoming sets remember), and then promotes the
+		//	surviving nursery pages to old pages. A major cycle collects
+		//	everything, and returns old pages that are mostly free to the
+		//	nursery so that their space is reused.
+		//
+		bool generational = false;
+
+		//------------------------------------------------------------------------
+		//	Data: Remembered sets
+		//
+		//	Each page's incoming set lists the deferred_ptrs on other pages that
+		//	point into it, which a partial (minor or regions) cycle treats as
+		//	roots. Keeping them costs a page lookup and a hash set update on
+		//	every store into a deferred_ptr in the heap, so they are kept only
+		//	while generational or region collection mode needs them, and are
+		//	rebuilt from the pages' deferred_ptrs when either is turned on. If
+		//	an update can't get the memory it needs, the sets are rebuilt
+		//	before the next partial cycle.
+		//
+		bool region_collection = false;
+		std::atomic<bool> remembered_sets_lost{ false };
+
+		bool remembers() const noexcept {
+			return generational || region_collection;
+		}
+
+		void rebuild_remembered_sets() noexcept;
+
+		//------------------------------------------------------------------------
+		//	Data: Collection cycle state, kept between collect_step calls
+		//
+		//	A cycle marks from a snapshot of the roots taken when it begins, and
+		//	then sweeps page by page. While marking, the write barrier shades the
+		//	old target of every deferred_ptr that is overwritten or destroyed
+		//	(snapshot-at-the-beginning), and new allocations are born marked, so
+		//	everything reachable when the cycle began survives it.
+		//
+		enum class collect_phase { idle, marking, sweeping };
+		enum class cycle_kind { full, minor, regions };	// which pages are condemned
+
+		struct gray_allocation {
+			dhpage* page;
+			int		start;		// location where the allocation starts
+		};
+
+		std::atomic<collect_phase>	 phase{ collect_phase::idle };
+		cycle_kind					 cycle = cycle_kind::full;
+		bool						 is_collecting = false;	// for reentrancy checks
+		std::vector<gray_allocation> gray;			// marked but not yet scanned
+		std::list<dhpage>::iterator	 sweep_page;	// next page to sweep
+		int							 sweep_location = 0;
+
+		//	Reentrancy guard for collection work, which runs destructors
+		//
+		struct collecting_scope {
+			bool& flag;
+
+			collecting_scope(deferred_heap& heap) : flag{ heap.is_collecting } {
+				Expects(!flag && "collection cannot be started from a deferred destructor");
+				flag = true;
+			}
+
+			~collecting_scope() {
+				flag = false;
+			}
+		};
+
+		//------------------------------------------------------------------------
+		//	Data: Background collector
+		//
+		//	When enabled, a dedicated thread performs each collection cycle in
+		//	short steps, and collect() only starts a cycle by snapshotting the
+		//	roots. While a cycle is in progress the heap's data structures are
+		//	shared with that thread, so every operation that touches them takes
+		//	the heap mutex. Only the (single) mutator thread can start a cycle,
+		//	so between cycles it needs no lock at all.
+		//
+		std::thread					 collector;
+		mutable std::recursive_mutex mutex;
+		std::condition_variable_any	 collector_cv;
+		bool						 stop_collector = false;
+
+		std::unique_lock<std::recursive_mutex> lock_if_shared() const;
+		void run_collector();
+
+		//------------------------------------------------------------------------
+		//	Data: Deferred finalization
+		//
+		//	When enabled, sweeping neither runs destructors nor deallocates. It
+		//	moves each batch of unreachable allocations' destructors into the
+		//	finalizers queue, and flags the allocations as finalizing so that
+		//	no later cycle sweeps (or compaction moves) them again. Then
+		//	drain_finalizers(), or the finalizer thread, runs the destructors
+		//	without holding the heap mutex, and deallocates the storage. While
+		//	there is a finalizer thread the heap is always shared with it.
+		//
+		struct finalization {
+			dhpage*				page = nullptr;
+			std::vector<int>	starts;		// allocations to deallocate afterwards
+			destructors::batch	batch;
+		};
+
+		bool						deferred_finalization = false;
+		std::list<finalization>		finalizers;
+		std::size_t					finalizers_running = 0;
+		std::thread					finalizer;
+		std::condition_variable_any	finalizer_cv;
+		bool						stop_finalizer = false;
+
+		bool finalize_one(std::size_t& objects, std::size_t& bytes);
+		void run_finalizer();
+
+		//------------------------------------------------------------------------
+		//	Data: Eager release
+		//
+		//	A container usually still refers to the storage it deallocates until
+		//	deallocate returns, so deferred_allocator queues the storage here,
+		//	and it is released at the next allocation that takes the slow path
+		//	if nothing refers to it by then. Starting a cycle clears the queue,
+		//	since the cycle's sweep may deallocate (and reuse) the same storage.
+		//
+		std::vector<const byte*> pending_releases;
+
+		void release_later(const void* p) noexcept;
+		std::size_t release_unreferenced(std::vector<const byte*>& candidates);
+
+		//------------------------------------------------------------------------
+		//	Data: Allocator handles
+		//
+		//	A deferred_allocator refers to its heap through one of these, so
+		//	that adopt() can re-point the containers built on the adopted heap.
+		//	The first is this heap's own, and the rest came from adopted heaps.
+		//	A list, so that each handle stays put.
+		//
+		std::list<deferred_heap*> handles{ this };
+
+		deferred_heap* const* handle() const noexcept { return &handles.front(); }
+
+		//------------------------------------------------------------------------
+		//	Data: Thread-safe mode
+		//
+		//	In thread-safe mode any number of threads can use the heap. Each
+		//	thread that does is a mutator, which allocates from its own page
+		//	that no other thread allocates from, and registers the deferred_ptrs
+		//	it creates outside the heap in its own roots. A mutator holds its
+		//	own mutex for each operation, and each page's registries have their
+		//	own mutex, so threads only contend when they register deferred_ptrs
+		//	on the same page. Operations on the whole heap, such as collecting
+		//	and finding a new page to allocate from, stop the world: they take
+		//	the heap mutex and then every mutator's mutex, so they run only at
+		//	safepoints, when no thread is in the middle of an operation.
+		//
+		struct mutator {
+			std::thread::id						  thread;
+			std::size_t							  index;			// in mutators
+			std::recursive_mutex				  mutex;			// held during each operation
+			std::mutex							  roots_mutex;		// other threads can deregister roots
+			std::vector<const deferred_ptr_void*> roots;
+			dhpage*								  page[2]   = {};		// its allocation pages, indexed
+																	// by pointer_free
+			std::size_t							  allocated = 0;		// bytes, since the last pace
+
+			mutator(std::thread::id t, std::size_t i) : thread{ t }, index{ i } { }
+		};
+
+		bool						thread_safe = false;
+		std::uint64_t const			id = new_id();	// for threads to find their mutator
+		mutable std::deque<mutator>	mutators;
+		std::mutex					roots_mutex;	// guards roots and root_ranges, in thread-safe mode
+
+		static std::uint64_t new_id() {
+			static std::atomic<std::uint64_t> next{ 0 };
+			return ++next;
+		}
+
+		mutator& this_mutator() const;
+		std::vector<std::unique_lock<std::recursive_mutex>> stop_the_world() const;
+		void release_pages();
+
+		template<class F>
+		void for_each_root(F f) const;
+
+		//	A registry of deferred_ptrs: the heap's roots, a mutator's roots, or
+		//	a page's deferred_ptrs. A root's slot also records whose roots it is
+		//	in, in the high half (tag 0 for the heap's, else its mutator's index
+		//	+ 1), so that another thread can find it to deregister it.
+		//
+		struct registry_ref {
+			std::vector<const deferred_ptr_void*>& ptrs;
+			std::mutex*							   mutex;	// to lock, in thread-safe mode
+			std::size_t							   tag;
+
+			std::unique_lock<std::mutex> lock() const {
+				return mutex != nullptr ? std::unique_lock<std::mutex>{ *mutex }
+										: std::unique_lock<std::mutex>{};
+			}
+		};
+
+		static constexpr int registry_shift = std::numeric_limits<std::size_t>::digits / 2;
+
+		registry_ref registry_for(dhpage* pg);	// where to register a new deferred_ptr
+		registry_ref registry_of(const deferred_ptr_void& p, dhpage* pg);
+
+		std::unique_lock<std::mutex> lock_page(dhpage& pg) const {
+			return thread_safe ? std::unique_lock<std::mutex>{ pg.mutex }
+							   : std::unique_lock<std::mutex>{};
+		}
 
 
 	public:
@@ -322,8 +953,51 @@ namespace gcpp {
 		//
 		deferred_heap() = default;
 
+		explicit deferred_heap(const deferred_heap_options& opts)
+			: options{ opts }
+		{ }
+
 		~deferred_heap();
 
+		//------------------------------------------------------------------------
+		//
+		//	reset: Destroy all the objects at once, without tracing, and keep
+		//	the pages to allocate from again
+		//
+		//	This is what the destructor does, except that the heap stays usable:
+		//	it runs any remaining destructors (objects of trivially destructible
+		//	types have none), resets the roots to null and empties the root
+		//	vectors, and marks every page empty. Like the destructor, it detaches
+		//	the deferred_ptrs in the heap first, so that they are null in the
+		//	destructors, which must not allocate from this heap.
+		//
+		void reset();
+
+		//------------------------------------------------------------------------
+		//
+		//	adopt: Move all of other's objects into this heap, leaving other
+		//	empty, without copying or tracing anything
+		//
+		//	The pages move with their objects and destructors, and other's roots
+		//	and root vectors (and the deferred_ptrs in the objects) now point
+		//	into this heap. So do the containers built on other, whose later
+		//	allocations come from this heap. In thread-safe mode, the roots are
+		//	registered as this thread's. other must be used by only one thread,
+		//	and must have the same conservative scanning mode if it has any pages.
+		//
+		void adopt(deferred_heap&& other);
+
+		//------------------------------------------------------------------------
+		//
+		//	release: Destroy and deallocate the allocation that p points into
+		//	right away, if no deferred_ptr or root vector refers to it (one
+		//	inside the allocation itself doesn't count), and return whether it
+		//	did. As when sweeping, the allocation's deferred_ptrs are reset
+		//	first. Nothing is released during a collection cycle or with
+		//	conservative scanning, when such references can't all be found.
+		//
+		bool release(const void* p);
+
 		//------------------------------------------------------------------------
 		//
 		//	make: Allocate one object of type T initialized with args
@@ -371,10 +1045,20 @@ namespace gcpp {
 		struct find_dhpage_info_ret {
 			dhpage* page = nullptr;
 			gpage::contains_info_ret info;
+			gsl::span<byte> extent;		// of the allocation, if p is in one
 		};
 		template<class T>
 		find_dhpage_info_ret find_dhpage_info(T* p) noexcept;
 
+		//	Whether T objects go on pointer-free pages. With conservative
+		//	scanning none do, since even a trivially copyable object can hold
+		//	raw pointers.
+		//
+		template<class T>
+		bool on_pointer_free_page() const noexcept {
+			return is_pointer_free<T>::value && !conservative_scan;
+		}
+
 		template<class T>
 		std::pair<dhpage*, byte*> allocate_from_existing_pages(int n);
 
@@ -396,19 +1080,203 @@ namespace gcpp {
 		//
 		//	collect, et al.: Sweep the deferred heap
 		//
-		void mark(const deferred_ptr_void& p, std::size_t level) noexcept;
+		void write_barrier(const void* p) noexcept;
+		void link_incoming(const deferred_ptr_void& dp, const dhpage* from) noexcept;
+		void unlink_incoming(const deferred_ptr_void& dp) noexcept;
+
+		void start_cycle(cycle_kind kind = cycle_kind::full);
+		void shade(const void* p);
+		void shade_word(std::uintptr_t w);
+		void mark(dhpage& pg, int start);
+		void index_pointers(dhpage& pg);
+		template<class F>
+		void for_each_laid_out(dhpage& pg, int where, F f);
+		static std::pair<byte*, byte*> words_of(dhpage& pg, int where) noexcept;
+		static std::uintptr_t word_at(const byte* at) noexcept;
+		void scan_words(dhpage& pg, int where);
+		template<class F>
+		void for_each_signed(dhpage& pg, int where, F f);
+		std::size_t scan(gray_allocation g);
+		void reset_unreachable(dhpage& pg);
+		std::size_t sweep_allocations(dhpage& pg, const std::vector<int>& starts);
+		void sweep(dhpage& pg);
+		void sweep_all();
+		void drop_empty_pages();
+		void detach_heap_pointers() noexcept;
+		void end_cycle();
+		void update_generations();
 
 	public:
 		void collect();
 
+		//	Perform up to budget's worth of collection work, resuming the cycle
+		//	in progress (or starting a new one). Returns true if a cycle finished.
+		//
+		bool collect_step(collect_budget budget);
+
+		//	Wait for (or, without a background collector, perform) the rest of
+		//	the collection cycle in progress, if any.
+		//
+		void finish_collection();
+
+		//	Run collection cycles on a dedicated thread. collect() then just
+		//	snapshots the roots and returns, and destructors of unreachable
+		//	objects run on the collector thread. Not available in thread-safe
+		//	mode or with conservative scanning.
+		//
+		auto get_background_collector() const {
+			return collector.joinable();
+		}
+
+		void set_background_collector(bool enable = false);
+
+		//	Deferred finalization: collection only resets the deferred_ptrs in
+		//	unreachable objects and queues their destructors, so that the
+		//	destructors' work is out of the pause. drain_finalizers() then runs
+		//	up to budget's worth of queued destructors (in whole sweep batches)
+		//	and deallocates their storage, and returns true if none are left.
+		//	Until then the storage is not reused. A finalizer thread drains the
+		//	queue as it fills; enabling it enables deferred finalization.
+		//
+		auto get_deferred_finalization() const {
+			return deferred_finalization;
+		}
+
+		void set_deferred_finalization(bool enable = false);
+
+		bool drain_finalizers(collect_budget budget = collect_budget::unlimited());
+
+		auto get_finalizer_thread() const {
+			return finalizer.joinable();
+		}
+
+		void set_finalizer_thread(bool enable = false);
+
+		//	Thread-safe mode: let any number of threads allocate from and
+		//	collect the heap concurrently, and build graphs across threads (see
+		//	mutator). Each collection stops the world, so collect_step always
+		//	completes its cycle. This cannot be combined with a background
+		//	collector or deferred finalization, and must be changed only while
+		//	a single thread is using the heap.
+		//
+		auto get_thread_safe() const {
+			return thread_safe;
+		}
+
+		void set_thread_safe(bool enable = false);
+
+		//	Generational mode: allocate new objects in a nursery that
+		//	collect_minor() can collect without tracing the older objects.
+		//	collect_major() (same as collect()) collects the whole heap.
+		//
+		auto get_generational() const {
+			return generational;
+		}
+
+		void set_generational(bool enable = false);
+
+		void collect_minor();
+
+		void collect_major() {
+			collect();
+		}
+
+		//	Region collection mode: remember, for each page, the deferred_ptrs
+		//	on other pages that point into it, as collect_regions() requires.
+		//	(Generational mode remembers them too.) This makes every store into
+		//	a deferred_ptr in the heap slower, so it is off by default.
+		//
+		auto get_region_collection() const {
+			return region_collection;
+		}
+
+		void set_region_collection(bool enable = false);
+
+		//	Collect just the (up to) max_pages pages with the most estimated
+		//	garbage, treating deferred_ptrs on other pages that point into them
+		//	as roots, so that the work is bounded by those pages rather than
+		//	by the whole heap. A page's live bytes are estimated as those that
+		//	survived its last collection, and anything allocated on it since
+		//	is presumed to be garbage. Unreachable cycles that span pages that
+		//	are not collected together survive until the next collect().
+		//
+		void collect_regions(int max_pages);
+
+		//	Lazy sweeping: a cycle only marks (and resets the deferred_ptrs in
+		//	unreachable objects), and each page's unreachable objects are then
+		//	destroyed and deallocated when allocation next needs space on that
+		//	page, or by finish_sweep(). This moves the sweeping out of the pause
+		//	and into allocation. It does not apply while there is a background
+		//	collector, which already sweeps off the mutator's thread.
+		//
+		auto get_lazy_sweep() const {
+			return lazy_sweep;
+		}
+
+		void set_lazy_sweep(bool enable = false);
+
+		void finish_sweep();
+
+		//	Conservative scanning: instead of registering the deferred_ptrs in
+		//	the heap's objects, a collection scans every word of each reached
+		//	allocation, and treats any word that points into an allocation
+		//	as a pointer that keeps it alive. This also traces raw pointers
+		//	stored in the objects (such as a container's internal links), but
+		//	an integer that happens to look like a pointer retains garbage.
+		//	Roots and laid-out objects stay precise. is_pointer_free doesn't
+		//	apply, since trivially copyable objects can hold raw pointers too.
+		//	Because raw pointers have no write barrier, collect_step always
+		//	completes its cycle, partial cycles scan all the pages they don't
+		//	collect, and compact() moves no objects. For the same reason it
+		//	can't be combined with a background collector, whose scan would
+		//	race with the mutator's raw pointer writes. This must be changed
+		//	only while the heap has no pages.
+		//
+		auto get_conservative_scan() const {
+			return conservative_scan;
+		}
+
+		void set_conservative_scan(bool enable = false);
+
+		//	Compaction: Run a full collection, then evacuate the objects in pages
+		//	less than max_occupancy full into denser pages, updating every
+		//	deferred_ptr that points to them, and release the emptied pages.
+		//	Only allocations whose objects are all relocatable (see
+		//	is_relocatable) are moved; other allocations pin their page.
+		//
+		void compact(double max_occupancy = 0.5);
+
+		//	Return the fraction of the pages' storage that is not in use
+		//
+		double fragmentation() const;
+
+		auto get_options() const {
+			return options;
+		}
+
+		void set_options(const deferred_heap_options& opts) {
+			options = opts;
+		}
+
 		auto get_collect_before_expand() {
-			return collect_before_expand;
+			return options.collect_before_expand;
 		}
 
 		void set_collect_before_expand(bool enable = false) {
-			collect_before_expand = enable;
+			options.collect_before_expand = enable;
 		}
 
+		//	Return the total storage of the heap's pages, in bytes
+		//
+		std::size_t heap_bytes() const;
+
+		//	Return the number of objects whose destructors are registered, and
+		//	the memory used to register them, in bytes
+		//
+		std::size_t destructor_count() const;
+
+		std::size_t destructor_bytes() const;
+
 		void debug_print() const;
 	};
 
@@ -430,6 +1298,12 @@ namespace gcpp {
 		template<class U>
 		friend class deferred_ptr;
 
+		template<class U>
+		friend class array_deferred_ptr;
+
+		template<class U>
+		friend class deferred_root_vector;
+
 	public:
 		// iterator traits
 		using value_type         = T;
@@ -464,7 +1338,19 @@ namespace gcpp {
 
 		deferred_ptr& operator=(const deferred_ptr& that) noexcept = default;	// trivial copy assignment
 
-		//	Copying with conversions (base -> derived, non-const -> const).
+		//	Moving.
+		//
+		deferred_ptr(deferred_ptr&& that) noexcept
+			: deferred_ptr_void(std::move(that))
+		{ }
+
+		deferred_ptr& operator=(deferred_ptr&& that) noexcept = default;
+
+		friend void swap(deferred_ptr& a, deferred_ptr& b) noexcept {
+			a.swap(b);
+		}
+
+		//	Copying and moving with conversions (base -> derived, non-const -> const).
 		//
 		template<class U, class = typename std::enable_if<std::is_convertible<U*, T*>::value, void>::type>
 		deferred_ptr(const deferred_ptr<U>& that)
@@ -477,6 +1363,17 @@ namespace gcpp {
 			return *this;
 		}
 
+		template<class U, class = typename std::enable_if<std::is_convertible<U*, T*>::value, void>::type>
+		deferred_ptr(deferred_ptr<U>&& that) noexcept
+			: deferred_ptr_void(std::move(that))
+		{ }
+
+		template<class U, class = typename std::enable_if<std::is_convertible<U*, T*>::value, void>::type>
+		deferred_ptr& operator=(deferred_ptr<U>&& that) noexcept {
+			deferred_ptr_void::operator=(std::move(that));
+			return *this;
+		}
+
 		//	Aliasing conversion: Type-safely forming a pointer to data member of T of type U.
 		//	Thanks to Casey Carter and Jon Caves for helping get this incantation right.
 		//
@@ -522,12 +1419,9 @@ namespace gcpp {
 
 		//	Checked pointer arithmetic
 		//
-		//	Future: This is checked in debug mode, but it might be better to split off
-		//	arithmetic into a separate array_deferred_ptr or deferred_span or suchlike
-		//	type. For now it's on deferred_ptr itself because when you instantiate
-		//	vector<T, deferred_allocator<T>> you need a pointer type that works as a
-		//	random-access iterator, and if we split this into an array_deferred_ptr type
-		//	we'll also need to make deferred_allocator use that instead... that can wait.
+		//	This is checked in debug mode by looking up both pointers in the heap,
+		//	which is expensive. deferred_allocator uses array_deferred_ptr instead,
+		//	which caches the allocation's bounds; prefer it for iterating over arrays.
 		//
 		deferred_ptr& operator+=(int offset) noexcept {
 #ifndef NDEBUG
@@ -695,7 +1589,23 @@ namespace gcpp {
 			return *this;
 		}
 
-		//	Copying with conversions (base -> derived, non-const -> const).
+		//	Moving.
+		//
+		deferred_ptr(deferred_ptr&& that) noexcept
+			: deferred_ptr_void(std::move(that))
+		{ }
+
+		deferred_ptr& operator=(deferred_ptr&& that) noexcept
+		{
+			deferred_ptr_void::operator=(std::move(that));
+			return *this;
+		}
+
+		friend void swap(deferred_ptr& a, deferred_ptr& b) noexcept {
+			a.swap(b);
+		}
+
+		//	Copying and moving with conversions (base -> derived, non-const -> const).
 		//
 		template<class U>
 		deferred_ptr(const deferred_ptr<U>& that)
@@ -708,6 +1618,17 @@ namespace gcpp {
 			return *this;
 		}
 
+		template<class U>
+		deferred_ptr(deferred_ptr<U>&& that) noexcept
+			: deferred_ptr_void(std::move(that))
+		{ }
+
+		template<class U>
+		deferred_ptr& operator=(deferred_ptr<U>&& that) noexcept {
+			deferred_ptr_void::operator=(std::move(that));
+			return *this;
+		}
+
 		//	Accessors.
 		//
 		void* get() const noexcept {
@@ -721,367 +1642,2580 @@ namespace gcpp {
 	};
 
 
-	//----------------------------------------------------------------------------
+	//------------------------------------------------------------------------
 	//
-	//	deferred_heap function implementations
+	//  array_deferred_ptr<T> is a deferred_ptr<T> into an array that, in
+	//	debug mode, also caches the bounds of its allocation. This is the
+	//	pointer type used by deferred_allocator, so that iterating over a
+	//	deferred_vector is checked in debug mode with two compares instead of
+	//	two heap lookups. In release mode it is just a deferred_ptr<T>.
 	//
-	//----------------------------------------------------------------------------
+	//	The bounds are kept as the number of elements before and after the
+	//	pointer rather than as addresses, so that they still hold after
+	//	compact() moves the allocation and updates the pointer.
 	//
-	inline
-	deferred_heap::~deferred_heap()
-	{
-		//	Note: setting this flag lets us skip worrying about reentrancy;
-		//	a destructor may not allocate a new object (which would try to
-		//	enregister and therefore change our data structures)
-		is_destroying = true;
+	//------------------------------------------------------------------------
+	//
+	template<class T>
+	class array_deferred_ptr {
+		deferred_ptr<T> ptr;
+#ifndef NDEBUG
+		ptrdiff_t below = 0;	// elements of the allocation before ptr, and
+		ptrdiff_t above = 0;	// from ptr to its end; both 0 if ptr is null
 
-		//	when destroying the arena, detach all pointers and run all destructors
-		//
-		for (auto& p : roots) {
-			const_cast<deferred_ptr_void*>(p)->detach();
+		bool in_bounds(ptrdiff_t offset) const noexcept {
+			return -below <= offset && offset <= above;
 		}
+#endif
 
-		for (auto& pg : pages) {
-			for (auto& p : pg.deferred_ptrs) {
-				const_cast<deferred_ptr_void*>(p.p)->detach();
+		template<class U>
+		friend class array_deferred_ptr;
+
+		//	Look up the bounds of the allocation ptr points into. Only needed
+		//	(and only done in debug mode) when we are given a pointer without
+		//	its bounds, such as when casting back from a void pointer.
+		//
+		void find_bounds() noexcept {
+#ifndef NDEBUG
+			if (ptr.get() == nullptr) {
+				return;
 			}
+
+			auto info = ptr.get_heap()->find_dhpage_info(ptr.get());
+
+			Expects(info.page != nullptr
+				&& info.info.found > gpage::in_range_unallocated
+				&& "corrupt non-null deferred_ptr, not pointing to an allocation");
+
+			auto lo = reinterpret_cast<T*>(info.extent.data());
+			below = ptr.get() - lo;
+			above = gsl::narrow_cast<ptrdiff_t>(info.extent.size() / sizeof(T)) - below;
+#endif
 		}
 
-		//	this calls user code (the dtors), but no reentrancy care is
-		//	necessary per note above
-		dtors.run_all();
-	}
+	public:
+		// iterator traits
+		using element_type       = T;
+		using value_type         = std::remove_cv_t<T>;
+		using pointer            = array_deferred_ptr<T>;
+		using reference          = std::add_lvalue_reference_t<T>;
+		using difference_type    = ptrdiff_t;
+		using iterator_category  = std::random_access_iterator_tag;
 
-	//	Add this deferred_ptr to the tracking list. Invoked when constructing a deferred_ptr.
-	//
-	inline
-	void deferred_heap::enregister(const deferred_ptr_void& p) {
-		//	append it to the back of the appropriate list
-		Expects(!is_destroying
-			&& "cannot allocate new objects on a deferred_heap that is being destroyed");
-		auto pg = find_dhpage_of(&p);
-		if (pg != nullptr)
+		//	Default and null construction.
+		//
+		array_deferred_ptr() = default;
+
+		array_deferred_ptr(std::nullptr_t) : array_deferred_ptr{} { }
+
+		//	Construction from a pointer to the first of n objects.
+		//
+		array_deferred_ptr(deferred_ptr<T> p, std::size_t n)
+			: ptr{ std::move(p) }
+#ifndef NDEBUG
+			, above{ gsl::narrow_cast<ptrdiff_t>(n) }
+#endif
 		{
-			pg->deferred_ptrs.push_back(&p);
+			Expects((ptr.get() != nullptr || n == 0) && "null pointer to a nonempty array");
 		}
-		else
+
+		//	Construction from a pointer whose bounds we don't know, including
+		//	the static_cast from deferred_allocator's void_pointer.
+		//
+		template<class U, class = typename std::enable_if<
+			std::is_convertible<U*, T*>::value || std::is_void<U>::value, void>::type>
+		explicit array_deferred_ptr(const deferred_ptr<U>& that)
+			: ptr{ that.get_heap(), static_cast<T*>(that.get()) }
 		{
-			roots.insert(&p);
+			find_bounds();
 		}
-	}
 
-	//	Remove this deferred_ptr from tracking. Invoked when destroying a deferred_ptr.
-	//
-	inline
-	void deferred_heap::deregister(const deferred_ptr_void& p) {
-		//	no need to actually deregister if we're tearing down this deferred_heap
-		if (is_destroying)
-			return;
-
-		//	find its entry, starting from the back because it's more
-		//	likely to be there (newer objects tend to have shorter
-		//	lifetimes... all local deferred_ptrs fall into this category,
-		//	and especially temporary deferred_ptrs)
+		//	Copying and moving, including with conversions (non-const -> const).
 		//
-		auto erased_count = roots.erase(&p);
-		Expects(erased_count < 2 && "duplicate registration");
-		if (erased_count > 0)
-			return;
+		array_deferred_ptr(const array_deferred_ptr&) = default;
+		array_deferred_ptr& operator=(const array_deferred_ptr&) = default;
+		array_deferred_ptr(array_deferred_ptr&&) noexcept = default;
+		array_deferred_ptr& operator=(array_deferred_ptr&&) noexcept = default;
 
-		for (auto& pg : pages) {
-			auto j = find_if(pg.deferred_ptrs.rbegin(), pg.deferred_ptrs.rend(),
-				[&p](auto x) { return x.p == &p; });
-			if (j != pg.deferred_ptrs.rend()) {
-				*j = pg.deferred_ptrs.back();
-				pg.deferred_ptrs.pop_back();
-				return;
-			}
-		}
+		template<class U, class = typename std::enable_if<std::is_convertible<U*, T*>::value, void>::type>
+		array_deferred_ptr(const array_deferred_ptr<U>& that)
+			: ptr{ that.ptr }
+#ifndef NDEBUG
+			, below{ that.below }
+			, above{ that.above }
+#endif
+		{ }
 
-		Expects(!"attempt to deregister an unregistered deferred_ptr");
-	}
+		friend void swap(array_deferred_ptr& a, array_deferred_ptr& b) noexcept {
+			a.ptr.swap(b.ptr);
+#ifndef NDEBUG
+			std::swap(a.below, b.below);
+			std::swap(a.above, b.above);
+#endif
+		}
 
-	//  Return the dhpage on which this object exists.
-	//	If the object is not in our storage, returns null.
-	//
-	template<class T>
-	deferred_heap::dhpage* deferred_heap::find_dhpage_of(T* p) noexcept {
-		if (p != nullptr) {
-			for (auto& pg : pages) {
-				if (pg.page.contains((byte*)p))
-					return &pg;
-			}
+		//	Conversion to a plain deferred_ptr, which forgets the bounds.
+		//
+		template<class U, class = typename std::enable_if<std::is_convertible<T*, U*>::value, void>::type>
+		operator deferred_ptr<U>() const {
+			return ptr;
 		}
-		return nullptr;
-	}
 
-	template<class T>
-	deferred_heap::find_dhpage_info_ret deferred_heap::find_dhpage_info(T* p)  noexcept {
-		find_dhpage_info_ret ret;
-		for (auto& pg : pages) {
-			auto info = pg.page.contains_info((byte*)p);
-			if (info.found != gpage::not_in_range) {
-				ret.page = &pg;
-				ret.info = info;
-			}
+		//	Accessors.
+		//
+		T* get() const noexcept {
+			return ptr.get();
 		}
-		return ret;
-	}
 
-	template<class T>
-	std::pair<deferred_heap::dhpage*, byte*>
-	deferred_heap::allocate_from_existing_pages(int n) {
-		for (auto& pg : pages) {
-			auto p = pg.page.allocate<T>(n);
-			if (p != nullptr)
-				return{ &pg, p };
+		deferred_heap* get_heap() const noexcept {
+			return ptr.get_heap();
 		}
-		return{ nullptr, nullptr };
-	}
 
-	template<class T>
-	deferred_ptr<T> deferred_heap::allocate(int n)
-	{
-		Expects(n > 0 && "cannot request an empty allocation");
+		explicit operator bool() const { return get() != nullptr; }
 
-		//	get raw memory from the backing storage...
-		auto p = allocate_from_existing_pages<T>(n);
+		std::add_lvalue_reference_t<T> operator*() const noexcept {
+			//	Not checked, for the same reason as deferred_ptr::operator*
+			return *get();
+		}
 
-		//	... performing a collection if necessary ...
-		if (p.second == nullptr && collect_before_expand) {
-			collect();
-			p = allocate_from_existing_pages<T>(n);
+		T* operator->() const noexcept {
+			Expects(get() && "attempt to dereference null");
+			return get();
 		}
 
-		//	... allocating another page if necessary
-		if (p.second == nullptr) {
-			//	pass along the type hint for size/alignment
-			pages.emplace_back((T*)nullptr, n, this);
-			p.first = &pages.back();	// Future: just use emplace_back's return value, in a C++17 STL
-			p = { p.first, p.first->page.template allocate<T>(n) };
+		std::add_lvalue_reference_t<T> operator[](difference_type offset) const noexcept {
+#ifndef NDEBUG
+			Expects(in_bounds(offset) && offset != above
+				&& "bad array_deferred_ptr subscript: outside the allocation");
+#endif
+			return get()[offset];
 		}
 
-		Expects(p.second != nullptr && "failed to allocate but didn't throw an exception");
-		return{ this, reinterpret_cast<T*>(p.second) };
-	}
+		int compare3(const array_deferred_ptr& that) const { return get() < that.get() ? -1 : get() == that.get() ? 0 : 1; };
+		GCPP_TOTALLY_ORDERED_COMPARISON(array_deferred_ptr);
 
-	template<class T, class ...Args>
-	void deferred_heap::construct(gsl::not_null<T*> p, Args&& ...args)
-	{
-		//	if there are objects with deferred destructors in this
-		//	region, run those first and remove them
-		destroy_objects({ (byte*)p.get(), sizeof(T) });
+		//	Pointer arithmetic, checked in debug mode: the result must stay
+		//	within the allocation, or one past its end.
+		//
+		array_deferred_ptr& operator+=(difference_type offset) noexcept {
+#ifndef NDEBUG
+			Expects(in_bounds(offset)
+				&& "bad array_deferred_ptr arithmetic: attempt to go outside the allocation");
+			below += offset;
+			above -= offset;
+#endif
+			ptr.set(get() + offset);
+			return *this;
+		}
 
-		//	construct the object...
+		array_deferred_ptr& operator-=(difference_type offset) noexcept {
+			return operator+=(-offset);
+		}
 
-		//	=====================================================================
-		//  === BEGIN REENTRANCY-SAFE: ensure no in-progress use of private state
-		::new (static_cast<void*>(p.get())) T{ std::forward<Args>(args)... };
-		//  === END REENTRANCY-SAFE: reload any stored copies of private state
-		//	=====================================================================
+		array_deferred_ptr& operator++() noexcept {
+			return operator+=(1);
+		}
 
-		//	... and store the destructor
-		dtors.store(gsl::span<T>(p, 1));
-	}
+		array_deferred_ptr operator++(int) noexcept {
+			auto ret = *this;
+			operator+=(1);
+			return ret;
+		}
 
-	template<class T>
-	void deferred_heap::construct_array(gsl::not_null<T*> p, int n)
-	{
-		Expects(n > 0 && "cannot request an empty array");
+		array_deferred_ptr& operator--() noexcept {
+			return operator+=(-1);
+		}
 
-		//	if there are objects with deferred destructors in this
-		//	region, run those first and remove them
-		destroy_objects({ (byte*)p.get(), gsl::narrow_cast<int>(sizeof(T)) * n });
+		array_deferred_ptr operator--(int) noexcept {
+			auto ret = *this;
+			operator+=(-1);
+			return ret;
+		}
+
+		array_deferred_ptr operator+(difference_type offset) const noexcept {
+			auto ret = *this;
+			ret += offset;
+			return ret;
+		}
+
+		friend array_deferred_ptr operator+(difference_type offset, const array_deferred_ptr& p) noexcept {
+			return p + offset;
+		}
+
+		array_deferred_ptr operator-(difference_type offset) const noexcept {
+			return *this + -offset;
+		}
+
+		difference_type operator-(const array_deferred_ptr& that) const noexcept {
+#ifndef NDEBUG
+			//	Note that this intentionally permits subtracting two null pointers
+			Expects(get() - below == that.get() - that.below
+				&& "bad array_deferred_ptr arithmetic: pointers into different allocations");
+#endif
+			return get() - that.get();
+		}
+	};
+
+
+	//------------------------------------------------------------------------
+	//
+	//  deferred_root_vector<T> is a vector of pointers to objects in a
+	//	deferred_heap that keeps them alive. Unlike a vector<deferred_ptr<T>>,
+	//	which registers each element as a separate root (and re-registers them
+	//	all whenever it reallocates), it registers a single root range of raw
+	//	pointers, which a collection scans as a contiguous array. Elements are
+	//	read as T*, or as a deferred_ptr via at(), and written only through
+	//	the member functions, which apply the write barrier.
+	//
+	//------------------------------------------------------------------------
+	//
+	template<class T>
+	class deferred_root_vector {
+		//	held indirectly so that the registered range stays put when this
+		//	vector is moved; a moved-from vector can only be destroyed or
+		//	assigned to
+		std::unique_ptr<deferred_heap::root_range> range;
+
+		deferred_heap& heap() const {
+			Expects(range != nullptr && range->myheap != nullptr
+				&& "deferred_root_vector's heap has been destroyed");
+			return *range->myheap;
+		}
+
+		void* to_void(T* p) const noexcept {
+			return const_cast<void*>(static_cast<const void*>(p));
+		}
+
+		void check_heap(const deferred_ptr<T>& p) const {
+			Expects((p.get() == nullptr || p.get_heap() == range->myheap)
+				&& "cannot store a pointer into a different deferred_heap");
+		}
+
+	public:
+		using value_type = T*;
+		using size_type  = std::size_t;
+
+		explicit deferred_root_vector(deferred_heap& h)
+			: range{ new deferred_heap::root_range{ &h, {}, 0 } }
+		{
+			h.enregister(*range);
+		}
+
+		deferred_root_vector(const deferred_root_vector& that)
+			: deferred_root_vector{ that.heap() }
+		{
+			heap().reserve(*range, that.size());
+			for (auto p : that.range->ptrs) {
+				heap().push(*range, p);
+			}
+		}
+
+		deferred_root_vector(deferred_root_vector&&) noexcept = default;
+
+		deferred_root_vector& operator=(const deferred_root_vector& that) {
+			auto tmp = that;
+			swap(tmp);
+			return *this;
+		}
+
+		deferred_root_vector& operator=(deferred_root_vector&& that) noexcept {
+			auto tmp = std::move(that);
+			swap(tmp);
+			return *this;
+		}
+
+		~deferred_root_vector() {
+			if (range != nullptr && range->myheap != nullptr) {
+				range->myheap->deregister(*range);
+			}
+		}
+
+		void swap(deferred_root_vector& that) noexcept {
+			std::swap(range, that.range);
+		}
+
+		friend void swap(deferred_root_vector& a, deferred_root_vector& b) noexcept {
+			a.swap(b);
+		}
+
+		deferred_heap* get_heap() const noexcept {
+			return range != nullptr ? range->myheap : nullptr;
+		}
+
+		//	Accessors.
+		//
+		size_type size() const noexcept {
+			return range->ptrs.size();
+		}
+
+		bool empty() const noexcept {
+			return range->ptrs.empty();
+		}
+
+		size_type capacity() const noexcept {
+			return range->ptrs.capacity();
+		}
+
+		T* operator[](size_type i) const noexcept {
+			return static_cast<T*>(range->ptrs[i]);
+		}
+
+		deferred_ptr<T> at(size_type i) const {
+			Expects(i < size() && "deferred_root_vector index out of range");
+			return{ &heap(), (*this)[i] };
+		}
+
+		T* front() const noexcept {
+			return (*this)[0];
+		}
+
+		T* back() const noexcept {
+			return (*this)[size() - 1];
+		}
+
+		//	Modifiers.
+		//
+		void reserve(size_type n) {
+			heap().reserve(*range, n);
+		}
+
+		void push_back(const deferred_ptr<T>& p) {
+			check_heap(p);
+			heap().push(*range, to_void(p.get()));
+		}
+
+		void set(size_type i, const deferred_ptr<T>& p) {
+			Expects(i < size() && "deferred_root_vector index out of range");
+			check_heap(p);
+			heap().store(*range, i, to_void(p.get()));
+		}
+
+		void pop_back() {
+			Expects(!empty() && "pop_back on an empty deferred_root_vector");
+			heap().truncate(*range, size() - 1);
+		}
+
+		void clear() {
+			heap().truncate(*range, 0);
+		}
+	};
+
+
+	//----------------------------------------------------------------------------
+	//
+	//	deferred_heap function implementations
+	//
+	//----------------------------------------------------------------------------
+	//
+	inline
+	deferred_heap::~deferred_heap()
+	{
+		set_background_collector(false);
+		set_finalizer_thread(false);
+
+		//	Note: setting this flag lets us skip worrying about reentrancy;
+		//	a destructor may not allocate a new object (which would try to
+		//	enregister and therefore change our data structures)
+		is_destroying = true;
+
+		//	when destroying the arena, detach all pointers and run all destructors
+		//
+		for_each_root([](auto p) {
+			const_cast<deferred_ptr_void*>(p)->detach();
+		});
+		for (auto r : root_ranges) {
+			r->myheap = nullptr;
+			r->ptrs.clear();
+		}
+		detach_heap_pointers();
+
+		//	this calls user code (the dtors), but no reentrancy care is
+		//	necessary per note above
+		finalizers.clear();
+		for (auto& pg : pages) {
+			pg.dtors.run_all();
+		}
+	}
+
+	//	Detach all the deferred_ptrs in the heap's objects, before the objects
+	//	are all destroyed together
+	//
+	inline
+	void deferred_heap::detach_heap_pointers() noexcept
+	{
+		for (auto& pg : pages) {
+			for (auto& p : pg.deferred_ptrs) {
+				const_cast<deferred_ptr_void*>(p)->detach();
+			}
+			if (pg.registers_pointers()) {
+				continue;
+			}
+			for (auto where = 0; where < pg.page.locations(); ++where) {
+				if (!pg.page.location_info(where).is_start) {
+					continue;
+				}
+				if (pg.layout != nullptr) {
+					for_each_laid_out(pg, where, [](deferred_ptr_void& dp) { dp.detach(); });
+				}
+				else {
+					for_each_signed(pg, where, [](deferred_ptr_void& dp) { dp.detach(); });
+				}
+			}
+		}
+	}
+
+	inline
+	void deferred_heap::adopt(deferred_heap&& other)
+	{
+		Expects(&other != this && "a deferred_heap cannot adopt itself");
+		Expects(!other.thread_safe && !other.collector.joinable() && !other.finalizer.joinable()
+			&& "an adopted deferred_heap must be used by only one thread");
+		Expects((other.pages.empty() || other.conservative_scan == conservative_scan)
+			&& "an adopted deferred_heap must have the same conservative scanning mode");
+		Expects(!is_collecting && !other.is_collecting
+			&& "a deferred_heap cannot be adopted from a deferred destructor");
+
+		//	neither heap can be in the middle of a cycle, which would be
+		//	tracing (or sweeping) only some of the objects, and other's queued
+		//	finalizers run in its own mode
+		other.finish_collection();
+		other.drain_finalizers();
+		finish_collection();
+
+		auto world = stop_the_world();
+		auto lock = lock_if_shared();
+
+		//	other's roots become this heap's...
+		other.for_each_root([&](auto p) {
+			auto& dp = const_cast<deferred_ptr_void&>(*p);
+			auto registry = registry_for(nullptr);
+			auto registry_lock = registry.lock();
+			dp.myheap = this;
+			dp.slot.store(registry.tag | registry.ptrs.size(), std::memory_order_relaxed);
+			registry.ptrs.push_back(&dp);
+		});
+		other.roots.clear();
+		for (auto& m : other.mutators) {
+			m.roots.clear();
+		}
+		{
+			std::unique_lock<std::mutex> ranges_lock{ roots_mutex, std::defer_lock };
+			if (thread_safe) {
+				ranges_lock.lock();
+			}
+			for (auto r : other.root_ranges) {
+				r->myheap = this;
+				r->slot = root_ranges.size();
+				root_ranges.push_back(r);
+			}
+			other.root_ranges.clear();
+		}
+
+		//	... and so do its pages, whose objects are then old objects here,
+		//	as set_generational treats existing objects
+		other.release_pages();
+		for (auto& pg : other.pages) {
+			pg.myheap = this;
+			pg.nursery = false;
+			for (auto p : pg.deferred_ptrs) {
+				const_cast<deferred_ptr_void*>(p)->myheap = this;
+			}
+			if (!pg.registers_pointers()) {
+				for (auto where = 0; where < pg.page.locations(); ++where) {
+					if (!pg.page.location_info(where).is_start) {
+						continue;
+					}
+					if (pg.layout != nullptr) {
+						for_each_laid_out(pg, where, [&](deferred_ptr_void& dp) {
+							if (dp.myheap != nullptr) {
+								dp.myheap = this;
+							}
+						});
+					}
+					else {
+						other.for_each_signed(pg, where, [&](deferred_ptr_void& dp) { dp.myheap = this; });
+					}
+				}
+			}
+			page_index.emplace(pg.page.extent().data(), &pg);
+		}
+		pages.splice(pages.end(), other.pages);
+		other.page_index.clear();
+		if (remembers() != other.remembers() || other.remembered_sets_lost) {
+			rebuild_remembered_sets();
+		}
+		pending_releases.insert(pending_releases.end(),
+			other.pending_releases.begin(), other.pending_releases.end());
+		other.pending_releases.clear();
+
+		//	containers built on other now allocate here, and other gets a new
+		//	handle for containers built on it from now on
+		for (auto& h : other.handles) {
+			h = this;
+		}
+		handles.splice(handles.end(), other.handles);
+		other.handles.push_back(&other);
+
+		allocated_since_cycle += other.allocated_since_cycle;
+		live_after_cycle	  += other.live_after_cycle;
+		other.allocated_since_cycle = 0;
+		other.live_after_cycle		= 0;
+	}
+
+	inline
+	bool deferred_heap::release(const void* p)
+	{
+		auto world = stop_the_world();
+		auto lock = lock_if_shared();
+		if (is_collecting) {
+			return false;	// e.g., a destructor run by a sweep
+		}
+		collecting_scope guard{ *this };
+		std::vector<const byte*> candidates{ static_cast<const byte*>(p) };
+		return release_unreferenced(candidates) > 0;
+	}
+
+	inline
+	void deferred_heap::release_later(const void* p) noexcept
+	{
+		//	in thread-safe mode another thread may still refer to the storage
+		//	through raw pointers, so it waits for a collection as before
+		if (p == nullptr || thread_safe || phase != collect_phase::idle) {
+			return;
+		}
+		auto lock = lock_if_shared();
+		try {
+			pending_releases.push_back(static_cast<const byte*>(p));
+		} catch(...) {
+			//	then a collection reclaims it
+		}
+	}
+
+	//	Destroy and deallocate each allocation that one of candidates points
+	//	into, if nothing refers to it, and return how many there were. The
+	//	only deferred_ptrs that can point into an allocation are the roots,
+	//	the ones on its own page, and the ones on other pages, which are in
+	//	its page's incoming set if the remembered sets are kept. So only
+	//	those are checked then, and otherwise every page is.
+	//
+	inline
+	std::size_t deferred_heap::release_unreferenced(std::vector<const byte*>& candidates)
+	{
+		if (phase != collect_phase::idle || conservative_scan) {
+			candidates.clear();
+			return 0;
+		}
+
+		struct candidate {
+			dhpage*		page;
+			int			start;
+			const byte* lo;			// the allocation's extent, including its
+			const byte* hi;			// one-past-the-end location
+			bool		referenced;
+		};
+		std::vector<candidate> allocations;
+		for (auto p : candidates) {
+			auto pg = find_dhpage_of(p);
+			if (pg == nullptr) {
+				continue;
+			}
+			auto where = pg->page.contains_info(p);
+			auto start = gsl::narrow_cast<int>(where.start_location);
+			if (where.found == gpage::in_range_unallocated || pg->finalizing.get(start)) {
+				continue;
+			}
+			auto extent = pg->page.allocation_extent(start);
+			allocations.push_back({ pg, start, extent.data(), extent.data() + extent.size(), false });
+		}
+		candidates.clear();
+		std::sort(allocations.begin(), allocations.end(), [](auto& a, auto& b) {
+			return std::less<const byte*>{}(a.lo, b.lo);
+		});
+		allocations.erase(std::unique(allocations.begin(), allocations.end(), [](auto& a, auto& b) {
+			return a.lo == b.lo;
+		}), allocations.end());
+
+		auto find = [&](const void* p) -> candidate* {
+			auto b = static_cast<const byte*>(p);
+			auto it = std::upper_bound(allocations.begin(), allocations.end(), b,
+				[](const byte* x, const candidate& c) { return std::less<const byte*>{}(x, c.lo); });
+			if (b == nullptr || it == allocations.begin() || !std::less<const byte*>{}(b, (--it)->hi)) {
+				return nullptr;
+			}
+			return &*it;
+		};
+
+		for_each_root([&](auto dp) {
+			if (auto c = find(dp->get())) {
+				c->referenced = true;
+			}
+		});
+		for (auto r : root_ranges) {
+			for (auto p : r->ptrs) {
+				if (auto c = find(p)) {
+					c->referenced = true;
+				}
+			}
+		}
+
+		auto check = [&](const deferred_ptr_void& dp) {
+			auto c = find(dp.get());
+			auto at = reinterpret_cast<const byte*>(&dp);
+			if (c != nullptr && (at < c->lo || c->hi <= at)) {
+				c->referenced = true;
+			}
+		};
+		auto check_page = [&](dhpage& pg) {
+			for (auto dp : pg.deferred_ptrs) {
+				check(*dp);
+			}
+			if (pg.layout != nullptr) {
+				for (auto where = 0; where < pg.page.locations(); ++where) {
+					if (pg.page.location_info(where).is_start) {
+						for_each_laid_out(pg, where, check);
+					}
+				}
+			}
+		};
+		if (remembers() && !remembered_sets_lost) {
+			for (std::size_t i = 0; i < allocations.size(); ++i) {
+				auto& pg = *allocations[i].page;
+				if (i > 0 && allocations[i - 1].page == &pg) {
+					continue;	// the allocations on a page are adjacent in address order
+				}
+				check_page(pg);
+				for (auto dp : pg.incoming) {
+					check(*dp);
+				}
+			}
+		}
+		else {
+			for (auto& pg : pages) {
+				if (!pg.pointer_free) {
+					check_page(pg);
+				}
+			}
+		}
+
+		std::size_t released = 0;
+		for (auto& c : allocations) {
+			if (c.referenced) {
+				continue;
+			}
+			auto& pg = *c.page;
+			std::vector<deferred_ptr_void*> inside;
+			for (auto dp : pg.deferred_ptrs) {
+				auto at = reinterpret_cast<const byte*>(dp);
+				if (c.lo <= at && at < c.hi) {
+					inside.push_back(const_cast<deferred_ptr_void*>(dp));
+				}
+			}
+			if (pg.layout != nullptr) {
+				for_each_laid_out(pg, c.start, [&](deferred_ptr_void& dp) { inside.push_back(&dp); });
+			}
+			for (auto dp : inside) {
+				dp->reset();
+			}
+
+			auto bytes = sweep_allocations(pg, { c.start });
+			pg.live_bytes -= std::min(pg.live_bytes, bytes);
+			++released;
+		}
+		return released;
+	}
+
+	inline
+	void deferred_heap::reset()
+	{
+		Expects(!is_collecting && !is_resetting
+			&& "a deferred_heap cannot be reset from a deferred destructor");
+
+		//	let a background cycle finish, and run the queued finalizers, which
+		//	are no longer shared with another thread once they are done
+		if (collector.joinable()) {
+			finish_collection();
+		}
+		drain_finalizers();
+
+		auto world = stop_the_world();
+		auto lock = lock_if_shared();
+
+		//	a cycle in progress has nothing left to find
+		phase = collect_phase::idle;
+		gray.clear();
+		pending_releases.clear();
+
+		//	detach the roots, whose registries then empty at once, and empty
+		//	the root vectors, which stay attached
+		for_each_root([](auto p) {
+			const_cast<deferred_ptr_void*>(p)->detach();
+		});
+		roots.clear();
+		for (auto& m : mutators) {
+			m.roots.clear();
+		}
+		for (auto r : root_ranges) {
+			r->ptrs.clear();
+		}
+		detach_heap_pointers();
+
+		//	the destructors can't allocate, nor run a collection; they can
+		//	destroy root vectors, which deregister normally
+		{
+			collecting_scope guard{ *this };
+			is_resetting = true;
+			finalizers.clear();
+			for (auto& pg : pages) {
+				pg.dtors.run_all();
+			}
+			is_resetting = false;
+		}
+
+		for (auto& pg : pages) {
+			pg.page.deallocate_all();
+			pg.live_starts.set_all(false);
+			pg.finalizing.set_all(false);
+			pg.deferred_ptrs.clear();
+			pg.traced_ptrs.clear();
+			pg.traced_starts.clear();
+			pg.traced_stale = true;
+			pg.incoming.clear();
+			pg.live_bytes = 0;
+			pg.nursery = generational;
+			pg.condemned = false;
+			pg.unswept = false;
+		}
+		allocated_since_cycle = 0;
+		live_after_cycle = 0;
+		for (auto& m : mutators) {
+			m.allocated = 0;
+		}
+	}
+
+	//	Add this deferred_ptr to the tracking list. Invoked when constructing a deferred_ptr.
+	//
+	inline
+	void deferred_heap::enregister(const deferred_ptr_void& p) {
+		//	append it to the back of the appropriate list
+		Expects(!is_destroying
+			&& "cannot allocate new objects on a deferred_heap that is being destroyed");
+		Expects(!is_resetting
+			&& "cannot allocate new objects on a deferred_heap that is being reset");
+		auto lock = lock_if_shared();
+		auto pg = find_dhpage_of(&p);
+		Expects((pg == nullptr || !pg->pointer_free)
+			&& "cannot store a deferred_ptr in an object of a pointer-free type");
+
+		//	a deferred_ptr in a laid-out object is found through its layout,
+		//	and one on a conservative page by its signature
+		if (pg != nullptr && pg->conservative) {
+			const_cast<deferred_ptr_void&>(p).slot.store(
+				conservative_signature, std::memory_order_relaxed);
+		}
+		else if (pg == nullptr || pg->registers_pointers()) {
+			auto registry = registry_for(pg);
+			auto registry_lock = registry.lock();
+			const_cast<deferred_ptr_void&>(p).slot.store(
+				registry.tag | registry.ptrs.size(), std::memory_order_relaxed);
+			registry.ptrs.push_back(&p);
+			if (pg != nullptr) {
+				pg->traced_stale = true;
+			}
+		}
+		if (pg != nullptr && p.get() != nullptr) {
+			link_incoming(p, pg);
+		}
+	}
+
+	//	Remove this deferred_ptr from tracking. Invoked when destroying a deferred_ptr.
+	//
+	inline
+	void deferred_heap::deregister(const deferred_ptr_void& p) {
+		//	no need to actually deregister if we're tearing down this deferred_heap
+		if (is_destroying)
+			return;
+
+		auto lock = lock_if_shared();
+
+		//	p's target is about to become unreachable through p
+		write_barrier(p.get());
+
+		auto pg = find_dhpage_of(&p);
+		if (pg != nullptr && !pg->conservative) {
+			unlink_incoming(p);
+		}
+
+		//	a deferred_ptr in a laid-out object or on a conservative page has
+		//	no entry, but it must not leave its target (or its signature)
+		//	behind in the object's storage
+		if (pg != nullptr && !pg->registers_pointers()) {
+			const_cast<deferred_ptr_void&>(p).p = nullptr;
+			const_cast<deferred_ptr_void&>(p).slot.store(0, std::memory_order_relaxed);
+			return;
+		}
+
+		//	p knows its entry, so just move the last entry into its place
+		//
+		auto registry = registry_of(p, pg);
+		auto registry_lock = registry.lock();
+		auto slot = p.slot.load(std::memory_order_relaxed);
+		auto index = slot - registry.tag;
+		Expects(index < registry.ptrs.size() && registry.ptrs[index] == &p
+			&& "attempt to deregister an unregistered deferred_ptr");
+		auto last = registry.ptrs.back();
+		const_cast<deferred_ptr_void*>(last)->slot.store(slot, std::memory_order_relaxed);
+		registry.ptrs[index] = last;
+		registry.ptrs.pop_back();
+		if (pg != nullptr) {
+			pg->traced_stale = true;
+		}
+	}
+
+	//	Move from's registration to to. If they are in the same registry (both
+	//	roots of the same thread, or both on the same page), to takes over
+	//	from's entry in place.
+	//
+	inline
+	void deferred_heap::transfer(deferred_ptr_void& from, deferred_ptr_void& to) noexcept {
+		auto lock = lock_if_shared();
+
+		//	to has the same target, but from may already have been scanned
+		write_barrier(from.p);
+
+		auto pg = find_dhpage_of(&to);
+		auto from_pg = find_dhpage_of(&from);
+		auto registry = registry_of(from, from_pg);
+		if (pg == from_pg && &registry_for(pg).ptrs == &registry.ptrs) {
+			if (pg != nullptr && pg->conservative) {
+				to.slot.store(conservative_signature, std::memory_order_relaxed);
+			}
+			else if (pg == nullptr || pg->registers_pointers()) {
+				auto registry_lock = registry.lock();
+				auto slot = from.slot.load(std::memory_order_relaxed);
+				auto index = slot - registry.tag;
+				Expects(index < registry.ptrs.size() && registry.ptrs[index] == &from
+					&& "attempt to move from an unregistered deferred_ptr");
+				to.slot.store(slot, std::memory_order_relaxed);
+				registry.ptrs[index] = &to;
+				if (pg != nullptr) {
+					pg->traced_stale = true;
+				}
+			}
+			if (pg != nullptr && !pg->conservative && to.p != nullptr) {
+				unlink_incoming(from);
+				link_incoming(to, pg);
+			}
+			from.detach();
+		}
+		else {
+			enregister(to);
+			deregister(from);
+			from.detach();
+		}
+	}
+
+	//	Add or remove a root range. Removing one is like destroying all of its
+	//	pointers, so their targets go through the write barrier.
+	//
+	inline
+	void deferred_heap::enregister(root_range& r) {
+		Expects(!is_destroying
+			&& "cannot add roots to a deferred_heap that is being destroyed");
+		auto lock = lock_if_shared();
+		std::unique_lock<std::mutex> ranges_lock{ roots_mutex, std::defer_lock };
+		if (thread_safe) {
+			ranges_lock.lock();
+		}
+		r.slot = root_ranges.size();
+		root_ranges.push_back(&r);
+	}
+
+	inline
+	void deferred_heap::deregister(root_range& r) noexcept {
+		if (is_destroying)
+			return;
+
+		auto lock = lock_if_shared();
+		for (auto p : r.ptrs) {
+			write_barrier(p);
+		}
+
+		std::unique_lock<std::mutex> ranges_lock{ roots_mutex, std::defer_lock };
+		if (thread_safe) {
+			ranges_lock.lock();
+		}
+		Expects(r.slot < root_ranges.size() && root_ranges[r.slot] == &r
+			&& "attempt to deregister an unregistered root range");
+		auto last = root_ranges.back();
+		last->slot = r.slot;
+		root_ranges[r.slot] = last;
+		root_ranges.pop_back();
+	}
+
+	inline
+	void deferred_heap::store(root_range& r, std::size_t i, void* p) noexcept {
+		auto lock = lock_if_shared();
+		write_barrier(r.ptrs[i]);
+		r.ptrs[i] = p;
+	}
+
+	inline
+	void deferred_heap::push(root_range& r, void* p) {
+		auto lock = lock_if_shared();
+		r.ptrs.push_back(p);
+	}
+
+	inline
+	void deferred_heap::reserve(root_range& r, std::size_t n) {
+		auto lock = lock_if_shared();
+		r.ptrs.reserve(n);
+	}
+
+	inline
+	void deferred_heap::truncate(root_range& r, std::size_t n) noexcept {
+		auto lock = lock_if_shared();
+		for (auto i = n; i < r.ptrs.size(); ++i) {
+			write_barrier(r.ptrs[i]);
+		}
+		r.ptrs.erase(r.ptrs.begin() + n, r.ptrs.end());
+	}
+
+	//	Return the registry a deferred_ptr on page pg (or a root, if pg is
+	//	null) is to be registered in, and the one p is registered in
+	//
+	inline
+	deferred_heap::registry_ref deferred_heap::registry_for(dhpage* pg) {
+		if (pg != nullptr) {
+			return{ pg->deferred_ptrs, thread_safe ? &pg->mutex : nullptr, 0 };
+		}
+		if (thread_safe) {
+			auto& m = this_mutator();
+			return{ m.roots, &m.roots_mutex, (m.index + 1) << registry_shift };
+		}
+		return{ roots, nullptr, 0 };
+	}
+
+	inline
+	deferred_heap::registry_ref deferred_heap::registry_of(const deferred_ptr_void& p, dhpage* pg) {
+		if (pg != nullptr) {
+			return registry_for(pg);
+		}
+		//	the tag is fixed while p is registered, so it's safe to read it
+		//	before taking the registry's lock
+		auto tag = p.slot.load(std::memory_order_relaxed) >> registry_shift;
+		if (thread_safe && tag != 0) {
+			auto& m = mutators[tag - 1];
+			return{ m.roots, &m.roots_mutex, tag << registry_shift };
+		}
+		return{ roots, thread_safe ? &roots_mutex : nullptr, 0 };
+	}
+
+	//  Return the dhpage on which this object exists.
+	//	If the object is not in our storage, returns null.
+	//
+	template<class T>
+	deferred_heap::dhpage* deferred_heap::find_dhpage_of(T* p) noexcept {
+		if (p != nullptr) {
+			//	the only page that can contain p is the last one starting at or before p
+			auto it = page_index.upper_bound((const byte*)p);
+			if (it != page_index.begin() && (--it)->second->page.contains((const byte*)p)) {
+				return it->second;
+			}
+		}
+		return nullptr;
+	}
+
+	template<class T>
+	deferred_heap::find_dhpage_info_ret deferred_heap::find_dhpage_info(T* p)  noexcept {
+		auto lock = lock_if_shared();
+		find_dhpage_info_ret ret;
+		ret.page = find_dhpage_of(p);
+		if (ret.page != nullptr) {
+			//	in thread-safe mode, another thread may be allocating on the page
+			auto page_lock = lock_page(*ret.page);
+			ret.info = ret.page->page.contains_info((byte*)p);
+			if (ret.info.found > gpage::in_range_unallocated) {
+				ret.extent = ret.page->page.allocation_extent(
+					gsl::narrow_cast<int>(ret.info.start_location));
+			}
+		}
+		return ret;
+	}
+
+	template<class T>
+	std::pair<deferred_heap::dhpage*, byte*>
+	deferred_heap::allocate_from_existing_pages(int n) {
+		for (auto& pg : pages) {
+			if (generational && !pg.nursery) {
+				continue;	// new objects go in the nursery
+			}
+			if (pg.owned) {
+				continue;	// only its mutator allocates from it
+			}
+			if (pg.pointer_free != on_pointer_free_page<T>() || pg.layout != layout_of<T>()) {
+				continue;	// pointer-free and laid-out objects have pages of their own
+			}
+			if (pg.unswept) {
+				if (is_collecting) {
+					continue;	// e.g., a destructor run by a sweep allocating
+				}
+				collecting_scope guard{ *this };
+				sweep(pg);
+			}
+			auto p = pg.page.allocate<T>(n);
+			if (p != nullptr)
+				return{ &pg, p };
+		}
+		return{ nullptr, nullptr };
+	}
+
+	template<class T>
+	deferred_ptr<T> deferred_heap::allocate(int n)
+	{
+		Expects(n > 0 && "cannot request an empty allocation");
+
+		//	in thread-safe mode, first try this thread's own allocation page,
+		//	which needs no other thread to stop
+		if (thread_safe) {
+			auto lock = lock_if_shared();
+			auto& m = this_mutator();
+			auto pg = m.page[on_pointer_free_page<T>()];
+			byte* p = nullptr;
+			if (pg != nullptr) {
+				//	other threads may be looking up their pointers into the page
+				auto page_lock = lock_page(*pg);
+				p = pg->page.template allocate<T>(n);
+			}
+			if (p != nullptr) {
+				pg->live_bytes += sizeof(T) * n;
+				m.allocated += sizeof(T) * n;
+				return{ this, reinterpret_cast<T*>(p) };
+			}
+		}
+
+		//	let the pacer collect first if the heap has grown enough
+		auto world = stop_the_world();
+		pace();
+		auto lock = lock_if_shared();
+		allocated_since_cycle += sizeof(T) * n;
+
+		//	release the storage that containers have deallocated since, so
+		//	that this allocation can reuse it
+		if (!pending_releases.empty() && !is_collecting) {
+			collecting_scope guard{ *this };
+			auto candidates = std::move(pending_releases);
+			pending_releases.clear();
+			release_unreferenced(candidates);
+		}
+
+		//	get raw memory from the backing storage...
+		auto p = allocate_from_existing_pages<T>(n);
+
+		//	... performing a collection if necessary ...
+		if (p.second == nullptr && options.collect_before_expand && !is_collecting) {
+			collect();
+			p = allocate_from_existing_pages<T>(n);
+		}
+
+		//	... allocating another page if necessary
+		if (p.second == nullptr) {
+			//	pass along the type hint for size/alignment
+			pages.emplace_back((T*)nullptr, n, this);
+			p.first = &pages.back();	// Future: just use emplace_back's return value, in a C++17 STL
+			p.first->nursery = generational;
+			p.first->pointer_free = on_pointer_free_page<T>();
+			p.first->layout = layout_of<T>();
+			p.first->conservative = conservative_scan && p.first->layout == nullptr;
+			page_index.emplace(p.first->page.extent().data(), p.first);
+			p = { p.first, p.first->page.template allocate<T>(n) };
+		}
+
+		Expects(p.second != nullptr && "failed to allocate but didn't throw an exception");
+		p.first->live_bytes += sizeof(T) * n;
+
+		//	during a collection cycle, new allocations are born marked
+		if (phase != collect_phase::idle) {
+			p.first->live_starts.set(gsl::narrow_cast<int>(
+				p.first->page.contains_info(p.second).location), true);
+		}
+
+		//	in thread-safe mode, this thread allocates from this page from now on
+		if (thread_safe) {
+			auto& page = this_mutator().page[on_pointer_free_page<T>()];
+			if (page != nullptr) {
+				page->owned = false;
+			}
+			page = p.first;
+			page->owned = true;
+		}
+
+		return{ this, reinterpret_cast<T*>(p.second) };
+	}
+
+	template<class T, class ...Args>
+	void deferred_heap::construct(gsl::not_null<T*> p, Args&& ...args)
+	{
+		//	if there are objects with deferred destructors in this
+		//	region, run those first and remove them
+		destroy_objects({ (byte*)p.get(), sizeof(T) });
+
+		//	construct the object...
+
+		//	=====================================================================
+		//  === BEGIN REENTRANCY-SAFE: ensure no in-progress use of private state
+		::new (static_cast<void*>(p.get())) T{ std::forward<Args>(args)... };
+		//  === END REENTRANCY-SAFE: reload any stored copies of private state
+		//	=====================================================================
+
+		//	... and store the destructor
+		auto lock = lock_if_shared();
+		auto pg = find_dhpage_of(p.get());
+		Expects(pg != nullptr && "attempt to construct an object outside the deferred heap");
+		auto page_lock = lock_page(*pg);
+		pg->dtors.store(gsl::span<T>(p, 1));
+	}
+
+	template<class T>
+	void deferred_heap::construct_array(gsl::not_null<T*> p, int n)
+	{
+		Expects(n > 0 && "cannot request an empty array");
+
+		//	if there are objects with deferred destructors in this
+		//	region, run those first and remove them
+		destroy_objects({ (byte*)p.get(), gsl::narrow_cast<int>(sizeof(T)) * n });
+
+		//	construct all the objects...
+
+		for (auto i = 0; i < n; ++i) {
+			//	=====================================================================
+			//  === BEGIN REENTRANCY-SAFE: ensure no in-progress use of private state
+			try {
+				::new (static_cast<void*>(p.get() + i)) T{};
+			} catch(...) {
+				while (i-- > 0) {
+					(p.get() + i)->~T();
+				}
+				throw;
+			}
+			//  === END REENTRANCY-SAFE: reload any stored copies of private state
+			//	=====================================================================
+		}
+
+		//	... and store the destructor
+		auto lock = lock_if_shared();
+		auto pg = find_dhpage_of(p.get());
+		Expects(pg != nullptr && "attempt to construct objects outside the deferred heap");
+		auto page_lock = lock_page(*pg);
+		pg->dtors.store(gsl::span<T>(p, n));
+	}
+
+	template<class T>
+	void deferred_heap::destroy(gsl::not_null<T*> p) noexcept
+	{
+		auto lock = lock_if_shared();
+		auto pg = find_dhpage_of(p.get());
+		Expects(pg != nullptr && "attempt to destroy an object outside the deferred heap");
+		auto page_lock = lock_page(*pg);
+		Expects(pg->dtors.is_stored(p)
+			&& "attempt to destroy an object whose destructor is not registered");
+	}
+
+	inline
+	bool deferred_heap::destroy_objects(gsl::span<byte> range) {
+		//	run them after releasing the locks, as they may deregister deferred_ptrs
+		//	or allocate, which can stop the world and so must not hold this
+		//	thread's mutator while it waits for the heap
+		destructors::batch b;
+		{
+			auto lock = lock_if_shared();
+			auto pg = find_dhpage_of(range.data());
+			if (pg == nullptr) {
+				return false;
+			}
+			auto page_lock = lock_page(*pg);
+			pg->dtors.take(range, b);
+		}
+		auto ran = !b.empty();
+		b.run();
+		return ran;
+	}
+
+	//------------------------------------------------------------------------
+	//
+	//	collect, et al.: Sweep the deferred heap
+	//
+
+	//	Set an attached deferred_ptr's value, shading the old value first
+	//
+	inline
+	void deferred_heap::store(deferred_ptr_void& dp, void* p) noexcept {
+		auto lock = lock_if_shared();
+		write_barrier(dp.p);
+
+		//	only deferred_ptrs in the heap are in remembered sets, and only
+		//	while a partial collection mode needs them
+		auto from = remembers() ? find_dhpage_of(&dp) : nullptr;
+		if (from != nullptr && !from->conservative) {
+			unlink_incoming(dp);
+		}
+		dp.p = p;
+		if (from != nullptr && p != nullptr) {
+			link_incoming(dp, from);
+		}
+	}
 
-		//	construct all the objects...
+	//	Return a lock on the heap if it is currently shared with the background
+	//	collector thread or the finalizer thread, else an empty lock. In
+	//	thread-safe mode, return a lock on this thread's mutator instead.
+	//
+	inline
+	std::unique_lock<std::recursive_mutex> deferred_heap::lock_if_shared() const {
+		if (thread_safe) {
+			return std::unique_lock<std::recursive_mutex>{ this_mutator().mutex };
+		}
+		if (finalizer.joinable() || (collector.joinable() && phase != collect_phase::idle)) {
+			return std::unique_lock<std::recursive_mutex>{ mutex };
+		}
+		return{};
+	}
 
-		for (auto i = 0; i < n; ++i) {
-			//	=====================================================================
-			//  === BEGIN REENTRANCY-SAFE: ensure no in-progress use of private state
-			try {
-				::new (static_cast<void*>(p.get() + i)) T{};
-			} catch(...) {
-				while (i-- > 0) {
-					(p.get() + i)->~T();
+	//	Return this thread's mutator, adding one if it doesn't have one yet
+	//
+	inline
+	deferred_heap::mutator& deferred_heap::this_mutator() const {
+		//	each thread remembers its mutator on the heap it used last
+		static thread_local struct {
+			std::uint64_t heap = 0;
+			mutator*	  m    = nullptr;
+		} last;
+
+		if (last.heap != id) {
+			auto me = std::this_thread::get_id();
+
+			//	other threads look up mutators by index, so adding one has to
+			//	stop the world
+			std::unique_lock<std::recursive_mutex> lock{ mutex };
+			auto it = std::find_if(mutators.begin(), mutators.end(),
+				[&](auto& m) { return m.thread == me; });
+			if (it != mutators.end()) {
+				last.m = &*it;
+			}
+			else {
+				std::vector<std::unique_lock<std::recursive_mutex>> world;
+				for (auto& m : mutators) {
+					world.emplace_back(m.mutex);
 				}
-				throw;
+				mutators.emplace_back(me, mutators.size());
+				last.m = &mutators.back();
 			}
-			//  === END REENTRANCY-SAFE: reload any stored copies of private state
-			//	=====================================================================
+			last.heap = id;
 		}
+		return *last.m;
+	}
 
-		//	... and store the destructor
-		dtors.store(gsl::span<T>(p, n));
+	//	In thread-safe mode, wait until every thread is at a safepoint and
+	//	keep them there until the returned locks are released
+	//
+	inline
+	std::vector<std::unique_lock<std::recursive_mutex>> deferred_heap::stop_the_world() const {
+		std::vector<std::unique_lock<std::recursive_mutex>> locks;
+		if (thread_safe) {
+			//	register this thread first, so that destructors run from here
+			//	can use the heap without adding a mutator
+			this_mutator();
+			locks.emplace_back(mutex);
+			for (auto& m : mutators) {
+				locks.emplace_back(m.mutex);
+			}
+		}
+		return locks;
+	}
+
+	//	Take back the mutators' allocation pages, before a collection cycle
+	//	or compaction changes what can be allocated where
+	//
+	inline
+	void deferred_heap::release_pages() {
+		for (auto& m : mutators) {
+			for (auto& page : m.page) {
+				if (page != nullptr) {
+					page->owned = false;
+					page = nullptr;
+				}
+			}
+		}
+	}
+
+	template<class F>
+	void deferred_heap::for_each_root(F f) const {
+		for (auto p : roots) {
+			f(p);
+		}
+		for (auto& m : mutators) {
+			for (auto p : m.roots) {
+				f(p);
+			}
+		}
+	}
+
+	inline
+	void deferred_heap::set_thread_safe(bool enable)
+	{
+		Expects((!enable || (!collector.joinable() && !deferred_finalization))
+			&& "thread-safe mode cannot be combined with a background collector or deferred finalization");
+
+		//	going back to a single thread, move all the roots into the heap's
+		if (!enable && thread_safe) {
+			release_pages();
+			for (auto& m : mutators) {
+				for (auto p : m.roots) {
+					const_cast<deferred_ptr_void*>(p)->slot.store(roots.size(), std::memory_order_relaxed);
+					roots.push_back(p);
+				}
+				m.roots.clear();
+				allocated_since_cycle += m.allocated;
+				m.allocated = 0;
+			}
+		}
+		thread_safe = enable;
+	}
+
+	//	Write barrier: Invoked with the old value of a deferred_ptr that is about
+	//	to be overwritten or destroyed. While marking, shade it so that the object
+	//	stays reachable in this cycle's snapshot even if it is now only reachable
+	//	through pointers we have already scanned (or not at all).
+	//
+	inline
+	void deferred_heap::write_barrier(const void* p) noexcept {
+		if (phase == collect_phase::marking && p != nullptr) {
+			shade(p);
+		}
+	}
+
+	//	Remembered sets: Each page's incoming set lists the deferred_ptrs on
+	//	other pages that currently point into it. Record dp, which is on page
+	//	from (or null if dp is a root), in its target page's set...
+	//
+	inline
+	void deferred_heap::link_incoming(const deferred_ptr_void& dp, const dhpage* from) noexcept
+	{
+		if (remembers() && from != nullptr && !from->conservative) {
+			auto to = find_dhpage_of(dp.get());
+			if (to != nullptr && to != from) {
+				auto page_lock = lock_page(*to);
+				try {
+					to->incoming.insert(&dp);
+				} catch(...) {
+					remembered_sets_lost = true;	// rebuild them before they are used
+				}
+			}
+		}
+	}
+
+	//	... and remove it again before dp is repointed or destroyed
+	//
+	inline
+	void deferred_heap::unlink_incoming(const deferred_ptr_void& dp) noexcept
+	{
+		if (!remembers()) {
+			return;
+		}
+		auto to = find_dhpage_of(dp.get());
+		if (to != nullptr) {
+			auto page_lock = lock_page(*to);
+			if (!to->incoming.empty()) {
+				to->incoming.erase(&dp);
+			}
+		}
+	}
+
+	//	Recompute every page's incoming set from the deferred_ptrs on the
+	//	other pages, or just empty them if they are not being kept
+	//
+	inline
+	void deferred_heap::rebuild_remembered_sets() noexcept
+	{
+		for (auto& pg : pages) {
+			pg.incoming.clear();
+		}
+		remembered_sets_lost = false;
+		if (!remembers()) {
+			return;
+		}
+
+		for (auto& pg : pages) {
+			for (auto dp : pg.deferred_ptrs) {
+				link_incoming(*dp, &pg);
+			}
+			if (pg.layout != nullptr) {
+				for (auto where = 0; where < pg.page.locations(); ++where) {
+					if (pg.page.location_info(where).is_start) {
+						for_each_laid_out(pg, where, [&](deferred_ptr_void& dp) { link_incoming(dp, &pg); });
+					}
+				}
+			}
+		}
+	}
+
+	//	Begin a collection cycle: condemn the pages to collect (all of them,
+	//	just the nursery, or the regions already chosen), reset their mark
+	//	bits, and shade the targets of all the roots
+	//
+	inline
+	void deferred_heap::start_cycle(cycle_kind kind)
+	{
+		if (kind != cycle_kind::full && remembered_sets_lost) {
+			rebuild_remembered_sets();
+		}
+
+		for (auto& pg : pages) {
+			if (kind != cycle_kind::regions) {
+				pg.condemned = kind == cycle_kind::full || pg.nursery;
+			}
+			if (pg.condemned) {
+				pg.live_starts.set_all(false);
+				pg.live_bytes = 0;
+			}
+		}
+
+		gray.clear();
+		pending_releases.clear();
+		cycle = kind;
+		release_pages();
+		allocated_since_cycle = 0;
+		for (auto& m : mutators) {
+			m.allocated = 0;
+		}
+		phase = collect_phase::marking;
+
+		for_each_root([&](auto p) {
+			if (p->get() != nullptr) {
+				shade(p->get());
+			}
+		});
+		for (auto r : root_ranges) {
+			for (auto p : r->ptrs) {
+				if (p != nullptr) {
+					shade(p);
+				}
+			}
+		}
+
+		//	a partial cycle doesn't trace the other pages, so their
+		//	deferred_ptrs into the condemned pages are roots too
+		if (kind != cycle_kind::full) {
+			for (auto& pg : pages) {
+				if (!pg.condemned) {
+					continue;
+				}
+				for (auto dp : pg.incoming) {
+					if (!find_dhpage_of(dp)->condemned) {
+						shade(dp->get());
+					}
+				}
+			}
+
+			//	conservative pages remember nothing, so scan all of their words
+			for (auto& pg : pages) {
+				if (pg.condemned || !pg.conservative) {
+					continue;
+				}
+				for (auto where = 0; where < pg.page.locations(); ++where) {
+					if (pg.page.location_info(where).is_start) {
+						scan_words(pg, where);
+					}
+				}
+			}
+		}
+	}
+
+	//	Mark the allocation that p points into as live, and remember to scan
+	//	it for deferred_ptrs if it wasn't already marked
+	//
+	inline
+	void deferred_heap::shade(const void* p)
+	{
+		// find which page it points into, if it's one being collected ...
+		auto pg = find_dhpage_of(p);
+		if (pg == nullptr || !pg->condemned) {
+			return;
+		}
+
+		auto where = pg->page.contains_info((byte*)p);
+		Expects(where.found != gpage::in_range_unallocated
+			&& "must not point to unallocated memory");
+
+		// ... and mark the chunk as live
+		mark(*pg, gsl::narrow_cast<int>(where.start_location));
+	}
+
+	//	Shade the allocation that the word w points into, if it is a pointer
+	//	into allocated memory on a page being collected at all
+	//
+	inline
+	void deferred_heap::shade_word(std::uintptr_t w)
+	{
+		auto p = reinterpret_cast<const byte*>(w);
+		auto pg = find_dhpage_of(p);
+		if (pg == nullptr || !pg->condemned) {
+			return;
+		}
+
+		auto where = pg->page.contains_info(p);
+		if (where.found != gpage::in_range_unallocated) {
+			mark(*pg, gsl::narrow_cast<int>(where.start_location));
+		}
+	}
+
+	//	Mark the allocation that starts at location start as live, and
+	//	remember to scan it if it wasn't already marked; a pointer-free
+	//	allocation has nothing to scan, so it is done
+	//
+	inline
+	void deferred_heap::mark(dhpage& pg, int start)
+	{
+		if (!pg.live_starts.get(start)) {
+			pg.live_starts.set(start, true);
+			if (pg.pointer_free) {
+				pg.live_bytes += pg.page.allocation_extent(start).size();
+			}
+			else {
+				gray.push_back({ &pg, start });
+			}
+		}
+	}
+
+	//	Sort this page's deferred_ptrs by address, if they have changed since
+	//	the last time, and record the allocation each one is in. Walking the
+	//	page's locations in the same order finds each allocation's start
+	//	without searching backward from every pointer.
+	//
+	inline
+	void deferred_heap::index_pointers(dhpage& pg)
+	{
+		if (!pg.traced_stale) {
+			return;
+		}
+
+		pg.traced_ptrs.assign(pg.deferred_ptrs.begin(), pg.deferred_ptrs.end());
+		std::sort(pg.traced_ptrs.begin(), pg.traced_ptrs.end(),
+			std::less<const deferred_ptr_void*>{});
+		pg.traced_starts.resize(pg.traced_ptrs.size());
+
+		auto const base = pg.page.extent().data();
+		auto location = 0, start = 0;
+		for (std::size_t i = 0; i < pg.traced_ptrs.size(); ++i) {
+			auto const where = gsl::narrow_cast<int>(
+				((const byte*)pg.traced_ptrs[i] - base) / pg.page.min_allocation());
+			for (; location <= where; ++location) {
+				if (pg.page.location_info(location).is_start) {
+					start = location;
+				}
+			}
+			Expects(where < pg.page.locations() && "deferred_ptr is not on its page");
+			pg.traced_starts[i] = start;
+		}
+		pg.traced_stale = false;
+	}
+
+	//	Call f on each deferred_ptr in the objects in the allocation that
+	//	starts at location where, on a page with a layout. Every location on
+	//	such a page holds one object, and the allocation's extent includes
+	//	its one-past-the-end location.
+	//
+	template<class F>
+	void deferred_heap::for_each_laid_out(dhpage& pg, int where, F f)
+	{
+		auto const& layout = *pg.layout;
+		Expects(pg.page.min_allocation() == layout.size
+			&& "a laid-out page must hold one object per location");
+		auto extent = pg.page.allocation_extent(where);
+		auto const end = extent.data() + extent.size() - layout.size;
+		for (auto object = extent.data(); object != end; object += layout.size) {
+			for (auto offset : layout.offsets) {
+				f(*reinterpret_cast<deferred_ptr_void*>(object + offset));
+			}
+		}
+	}
+
+	//	Return the range of pointer-aligned words in the objects in the
+	//	allocation that starts at location where, without its one-past-the-end
+	//	location
+	//
+	inline
+	std::pair<byte*, byte*> deferred_heap::words_of(dhpage& pg, int where) noexcept
+	{
+		auto extent = pg.page.allocation_extent(where);
+		auto const end = extent.data() + extent.size() - pg.page.min_allocation();
+		auto const misalignment = reinterpret_cast<std::uintptr_t>(extent.data()) % alignof(void*);
+		auto first = extent.data() + (misalignment == 0 ? 0 : alignof(void*) - misalignment);
+		return{ std::min(first, end), end };
+	}
+
+	inline
+	std::uintptr_t deferred_heap::word_at(const byte* at) noexcept
+	{
+		std::uintptr_t w;
+		std::memcpy(&w, at, sizeof(w));
+		return w;
+	}
+
+	//	Shade whatever each word of the allocation that starts at location
+	//	where, on a conservative page, might point to
+	//
+	inline
+	void deferred_heap::scan_words(dhpage& pg, int where)
+	{
+		auto words = words_of(pg, where);
+		for (auto at = words.first; at + sizeof(void*) <= words.second; at += alignof(void*)) {
+			shade_word(word_at(at));
+		}
+	}
+
+	//	Call f on each of this heap's deferred_ptrs in the allocation that
+	//	starts at location where, on a conservative page. They aren't
+	//	registered, so they are recognized by their myheap and their slot,
+	//	which holds the conservative_signature.
+	//
+	template<class F>
+	void deferred_heap::for_each_signed(dhpage& pg, int where, F f)
+	{
+		static_assert(std::is_standard_layout<deferred_ptr_void>::value
+			&& offsetof(deferred_ptr_void, myheap) == 0
+			&& sizeof(std::atomic<std::size_t>) == sizeof(std::size_t),
+			"deferred_ptr_void's layout must allow finding it by its signature");
+
+		auto words = words_of(pg, where);
+		for (auto at = words.first; at + sizeof(deferred_ptr_void) <= words.second; at += alignof(void*)) {
+			if (word_at(at) == reinterpret_cast<std::uintptr_t>(this)
+				&& word_at(at + offsetof(deferred_ptr_void, slot)) == conservative_signature) {
+				f(*reinterpret_cast<deferred_ptr_void*>(at));
+				at += sizeof(deferred_ptr_void) - alignof(void*);
+			}
+		}
+	}
+
+	//	Shade the targets of all the deferred_ptrs in the allocation g, count
+	//	it toward its page's live bytes, and return its size in bytes. The
+	//	allocation's deferred_ptrs are one run of the page's sorted index,
+	//	or are found through its layout, or are among its words.
+	//
+	inline
+	std::size_t deferred_heap::scan(gray_allocation g)
+	{
+		auto& pg = *g.page;
+		if (pg.layout != nullptr) {
+			for_each_laid_out(pg, g.start, [&](deferred_ptr_void& dp) {
+				if (dp.get() != nullptr) {
+					shade(dp.get());
+				}
+			});
+		}
+		else if (pg.conservative) {
+			scan_words(pg, g.start);
+		}
+		else {
+			index_pointers(pg);
+			auto const first = std::lower_bound(pg.traced_starts.begin(), pg.traced_starts.end(), g.start);
+			for (auto i = first - pg.traced_starts.begin();
+					i < static_cast<std::ptrdiff_t>(pg.traced_starts.size()) && pg.traced_starts[i] == g.start;
+					++i) {
+				auto target = pg.traced_ptrs[i]->get();
+				if (target != nullptr) {
+					shade(target);
+				}
+			}
+		}
+		auto size = pg.page.allocation_extent(g.start).size();
+		pg.live_bytes += size;
+		return size;
+	}
+
+	//	Reset all of this page's deferred_ptrs that are in unreached allocations
+	//
+	//	Note: 'const deferred_ptr' is supported and behaves as const w.r.t. the
+	//	the program code; however, a deferred_ptr data member can become
+	//	spontaneously null *during object destruction* even if declared
+	//	const to the rest of the program. So the collector is an exception
+	//	to constness, and the const_cast below is because any deferred_ptr must
+	//	be able to be set to null during collection, as part of safely
+	//	breaking cycles. (We could declare the data member mutable, but
+	//	then we might accidentally modify it in another const function.
+	//	Since a const deferred_ptr should only be reset in this one case, it's
+	//	more appropriate to avoid mutable and put the const_cast here.)
+	//
+	//	This is the same "don't touch other objects during finalization
+	//	because they may already have been finalized" rule as has evolved
+	//	in all cycle-breaking approaches. But, unlike the managed languages, here
+	//	the rule is actually directly supported and enforced (one object
+	//	being destroyed cannot touch another deferred-cleanup object by
+	//	accident because the deferred_ptr to that other object is null), it
+	//	removes the need for separate "finalizer" functions (we always run
+	//	real destructors, and only have to teach that deferred_ptrs might be null
+	//	in a destructor), and it eliminates the possibility of resurrection
+	//	(it is not possible for a destructor to make a collectable object
+	//	reachable again because we eliminate all pointers to it before any
+	//	user-defined destructor gets a chance to run). This is fully
+	//	compatible with learnings from existing approaches, but strictly
+	//	better in all these respects by directly enforcing those learnings
+	//	in the design, thus eliminating large classes of errors while also
+	//	minimizing complexity by inventing no new concepts other than
+	//	the rule "deferred_ptrs can be null in dtors."
+	//
+	//	Pages are reset one at a time just before they are swept. That is
+	//	still early enough: an unreachable object's destructor can only reach
+	//	other unreachable objects through its own deferred_ptrs, which are on
+	//	the page being swept and so have already been reset.
+	//
+	inline
+	void deferred_heap::reset_unreachable(dhpage& pg)
+	{
+		if (pg.layout != nullptr) {
+			for (auto where = 0; where < pg.page.locations(); ++where) {
+				if (pg.page.location_info(where).is_start
+					&& !pg.live_starts.get(where) && !pg.finalizing.get(where)) {
+					for_each_laid_out(pg, where, [](deferred_ptr_void& dp) { dp.reset(); });
+				}
+			}
+			return;
+		}
+
+		if (pg.conservative) {
+			for (auto where = 0; where < pg.page.locations(); ++where) {
+				if (pg.page.location_info(where).is_start
+					&& !pg.live_starts.get(where) && !pg.finalizing.get(where)) {
+					for_each_signed(pg, where, [](deferred_ptr_void& dp) { dp.reset(); });
+				}
+			}
+			return;
+		}
+
+		index_pointers(pg);
+		for (std::size_t i = 0; i < pg.traced_ptrs.size(); ++i) {
+			auto start = pg.traced_starts[i];
+			if (!pg.live_starts.get(start) && !pg.finalizing.get(start)) {
+				const_cast<deferred_ptr_void*>(pg.traced_ptrs[i])->reset();
+			}
+		}
+	}
+
+	//	Destroy and deallocate the unreachable allocations that start at the
+	//	given locations, and return their total size in bytes. Their
+	//	destructors run as one batch, grouped by type and in address order.
+	//	With deferred finalization, the batch is queued instead.
+	//
+	inline
+	std::size_t deferred_heap::sweep_allocations(dhpage& pg, const std::vector<int>& starts)
+	{
+		if (deferred_finalization) {
+			if (starts.empty()) {
+				return 0;
+			}
+			finalizers.emplace_back();
+			auto& f = finalizers.back();
+			f.page = &pg;
+			f.starts = starts;
+
+			std::size_t bytes = 0;
+			for (auto where : starts) {
+				auto extent = pg.page.allocation_extent(where);
+				pg.dtors.take(extent, f.batch);
+				pg.finalizing.set(where, true);
+				bytes += extent.size();
+			}
+			finalizer_cv.notify_all();
+			return bytes;
+		}
+
+		std::vector<gsl::span<byte>> extents;
+		extents.reserve(starts.size());
+		for (auto where : starts) {
+			extents.push_back(pg.page.allocation_extent(where));
+		}
+
+		// call the destructors for objects in these ranges
+		{
+			destructors::batch batch;
+			for (auto& extent : extents) {
+				pg.dtors.take(extent, batch);
+			}
+			batch.run();
+		}
+
+		// and then deallocate the raw storage
+		std::size_t bytes = 0;
+		for (auto& extent : extents) {
+			pg.page.deallocate(extent.data());
+			bytes += extent.size();
+		}
+		return bytes;
+	}
+
+	//	Lazy sweeping: Sweep a page that a cycle left unswept...
+	//
+	inline
+	void deferred_heap::sweep(dhpage& pg)
+	{
+		std::vector<int> dead;
+		for (auto where = 0; where < pg.page.locations(); ++where) {
+			if (pg.page.location_info(where).is_start && !pg.live_starts.get(where)
+				&& !pg.finalizing.get(where)) {
+				dead.push_back(where);
+			}
+		}
+		sweep_allocations(pg, dead);
+		pg.unswept = false;
+	}
+
+	//	... or all of them
+	//
+	inline
+	void deferred_heap::sweep_all()
+	{
+		for (auto& pg : pages) {
+			if (pg.unswept) {
+				sweep(pg);
+			}
+		}
+		drop_empty_pages();
+	}
+
+	//	Drop all now-unused pages, except for up to retained_empty_bytes of
+	//	them that are kept for reuse so that the next burst of allocations
+	//	doesn't have to allocate new pages again
+	//
+	inline
+	void deferred_heap::drop_empty_pages()
+	{
+		std::size_t retained = 0;
+		for (auto pg = pages.begin(); pg != pages.end(); ) {
+			if (!pg->page.is_empty()) {
+				++pg;
+				continue;
+			}
+
+			Ensures(pg->deferred_ptrs.empty() && "page with no allocations still has deferred_ptrs");
+			auto const size = static_cast<std::size_t>(pg->page.extent().size());
+			if (retained + size <= options.retained_empty_bytes) {
+				retained += size;
+				pg->nursery = generational;	// reuse it for new objects
+				++pg;
+				continue;
+			}
+
+			page_index.erase(pg->page.extent().data());
+			pg = pages.erase(pg);
+		}
 	}
 
-	template<class T>
-	void deferred_heap::destroy(gsl::not_null<T*> p) noexcept
+	//	End a cycle in generational mode. After a minor cycle, promote the
+	//	surviving nursery pages. After a major cycle, return old pages that
+	//	are now mostly free to the nursery.
+	//
+	inline
+	void deferred_heap::update_generations()
 	{
-		Expects(dtors.is_stored(p)
-			&& "attempt to destroy an object whose destructor is not registered");
+		for (auto& pg : pages) {
+			if (cycle == cycle_kind::minor) {
+				pg.nursery = false;
+			}
+			else if (cycle == cycle_kind::full
+				&& pg.live_bytes < static_cast<std::size_t>(pg.page.extent().size()) / 2) {
+				pg.nursery = true;
+			}
+		}
 	}
 
+	//	Finish the cycle in progress, once its pages are swept (or left unswept)
+	//
 	inline
-	bool deferred_heap::destroy_objects(gsl::span<byte> range) {
-		return dtors.run(range);
+	void deferred_heap::end_cycle()
+	{
+		if (generational) {
+			update_generations();
+		}
+
+		live_after_cycle = 0;
+		for (auto& pg : pages) {
+			live_after_cycle += pg.live_bytes;
+		}
+		phase = collect_phase::idle;
 	}
 
-	//------------------------------------------------------------------------
-	//
-	//	collect, et al.: Sweep the deferred heap
+	//	The pacer, invoked at the start of each allocation: start a collection
+	//	once the heap has grown by growth_target since the last cycle (and is
+	//	at least min_heap_bytes), and with a max_pause, advance an incremental
+	//	cycle in progress by one bounded step per allocation
 	//
 	inline
-	void deferred_heap::mark(const deferred_ptr_void& p, std::size_t level) noexcept
+	void deferred_heap::pace()
 	{
-		//	if it isn't null ...
-		if (p.get() == nullptr)
+		if (options.growth_target <= 0 || is_collecting) {
+			return;
+		}
+
+		//	a background cycle in progress needs no help
+		if (collector.joinable() && phase != collect_phase::idle) {
 			return;
+		}
 
-		// ... find which page it points into ...
-		for (auto& pg : pages) {
-			auto where = pg.page.contains_info((byte*)p.get());
-			Expects(where.found != gpage::in_range_unallocated
-				&& "must not point to unallocated memory");
-			if (where.found != gpage::not_in_range) {
-				// ... and mark the chunk as live ...
-				pg.live_starts.set(where.start_location, true);
-
-				// ... and mark any deferred_ptrs in the allocation as reachable
-				for (auto& dp : pg.deferred_ptrs) {
-					auto dp_where = pg.page.contains_info((byte*)dp.p);
-					Expects((dp_where.found == gpage::in_range_allocated_middle
-						|| dp_where.found == gpage::in_range_allocated_start)
-						&& "points to unallocated memory");
-					if (dp_where.start_location == where.start_location
-						&& dp.level == 0) {
-						dp.level = level;	// 'level' steps from a root
+		auto const incremental = options.max_pause.count() > 0;
+		if (phase != collect_phase::idle) {
+			if (incremental) {
+				collect_step(collect_budget::of_time(options.max_pause));
+			}
+			return;
+		}
+
+		//	count what the mutators have allocated from their own pages
+		for (auto& m : mutators) {
+			allocated_since_cycle += m.allocated;
+			m.allocated = 0;
+		}
+
+		auto const goal = std::max<double>(options.min_heap_bytes,
+			live_after_cycle * (1 + options.growth_target));
+		if (live_after_cycle + allocated_since_cycle < goal) {
+			return;
+		}
+
+		if (incremental && !collector.joinable()) {
+			collect_step(collect_budget::of_time(options.max_pause));
+		}
+		else {
+			collect();
+		}
+	}
+
+
+	inline
+	bool deferred_heap::collect_step(collect_budget budget)
+	{
+		std::unique_lock<std::recursive_mutex> lock{ mutex, std::defer_lock };
+		if (collector.joinable() || finalizer.joinable()) {
+			lock.lock();
+		}
+
+		//	in thread-safe mode, the other threads don't use the write barrier,
+		//	so a cycle can't be left in progress while they run; nor can it
+		//	while raw pointers are traced conservatively
+		auto world = stop_the_world();
+		if (thread_safe || conservative_scan) {
+			budget = collect_budget::unlimited();
+		}
+
+		collecting_scope guard{ *this };
+
+		//	Work is counted in allocations marked or swept. The first unit of
+		//	work is always allowed, so that every step makes progress.
+		//
+		using clock = collect_budget::clock;
+		auto const timed    = budget.time != clock::duration::max();
+		auto const deadline = timed ? clock::now() + budget.time : clock::time_point::max();
+		std::size_t objects = 0, bytes = 0;
+
+		auto exhausted = [&] {
+			return objects > 0
+				&& (objects >= budget.objects
+					|| bytes >= budget.bytes
+					|| (timed && clock::now() >= deadline));
+		};
+
+		//	1. begin a new cycle if one isn't already in progress, first
+		//	sweeping any pages that the last cycle left unswept
+		//
+		if (phase == collect_phase::idle) {
+			sweep_all();
+			start_cycle();
+		}
+
+		//	2. mark: scan the marked allocations for deferred_ptrs to the
+		//	allocations they keep alive, until there are no more to scan
+		//
+		while (phase == collect_phase::marking) {
+			if (gray.empty()) {
+				phase = collect_phase::sweeping;
+				sweep_page = pages.begin();
+				sweep_location = 0;
+
+				//	with lazy sweeping, just reset the unreached deferred_ptrs
+				//	now so that none outlives the memory it points to, and
+				//	leave the pages to be swept later
+				if (lazy_sweep && !collector.joinable()) {
+					for (auto& pg : pages) {
+						if (pg.condemned) {
+							reset_unreachable(pg);
+							pg.unswept = true;
+						}
 					}
+					end_cycle();
+					return true;
 				}
 				break;
 			}
+			if (exhausted()) {
+				return false;
+			}
+			auto g = gray.back();
+			gray.pop_back();
+			bytes += scan(g);
+			++objects;
+		}
+
+		//	We have now marked every allocation to save, so now
+		//	go through and clean up all the unreachable objects
+
+		//	3. sweep each page: reset its unreached deferred_ptrs to null, then
+		//	deallocate its unreachable allocations, running destructors if
+		//	registered
+		//
+		for (; sweep_page != pages.end(); ++sweep_page, sweep_location = 0) {
+			auto& pg = *sweep_page;
+			if (!pg.condemned) {
+				continue;
+			}
+			if (sweep_location == 0) {
+				reset_unreachable(pg);
+			}
+
+			while (sweep_location < pg.page.locations()) {
+				//	gather a batch of allocations to destroy and deallocate...
+				const std::size_t max_batch = 64;
+				std::vector<int> dead;
+				for (; sweep_location < pg.page.locations() && dead.size() < max_batch;
+						++sweep_location) {
+					if (!pg.page.location_info(sweep_location).is_start
+						|| pg.live_starts.get(sweep_location)
+						|| pg.finalizing.get(sweep_location)) {
+						continue;
+					}
+					if (exhausted()) {
+						break;
+					}
+					dead.push_back(sweep_location);
+					++objects;
+				}
+
+				//	... and sweep them together
+				bytes += sweep_allocations(pg, dead);
+				if (sweep_location < pg.page.locations() && exhausted()) {
+					return false;
+				}
+			}
 		}
+
+		//	4. finally, drop all now-unused pages
+		//
+		drop_empty_pages();
+		end_cycle();
+		return true;
 	}
 
 	inline
 	void deferred_heap::collect()
 	{
-		//	1. reset all the mark bits and in-arena deferred_ptr levels
+		//	with a background collector, the pause is just the root snapshot
 		//
-		for (auto& pg : pages) {
-			pg.live_starts.set_all(false);
-			for (auto& dp : pg.deferred_ptrs) {
-				dp.level = 0;
+		if (collector.joinable()) {
+			std::lock_guard<std::recursive_mutex> lock{ mutex };
+			if (phase == collect_phase::idle) {
+				start_cycle();
+				collector_cv.notify_all();
 			}
+			return;
 		}
 
-		//	2. mark all roots + the in-arena deferred_ptrs reachable from them
+		//	finish any cycle already in progress, which can only see garbage that
+		//	was unreachable when it began, then run a complete cycle of our own
 		//
-		std::size_t level = 1;
-		for (auto& p : roots) {
-			mark(*p, level);	// mark this deferred_ptr root
+		if (phase != collect_phase::idle) {
+			collect_step(collect_budget::unlimited());
 		}
+		collect_step(collect_budget::unlimited());
+	}
 
-		bool done = false;
-		while (!done) {
-			done = true;	// we're done unless we find another to mark
-			++level;
-			for (auto& pg : pages) {
-				for (auto& dp : pg.deferred_ptrs) {
-					if (dp.level == level - 1) {
-						done = false;
-						mark(*(dp.p), level);	// mark this reachable in-arena deferred_ptr
+	inline
+	void deferred_heap::finish_collection()
+	{
+		if (collector.joinable()) {
+			std::unique_lock<std::recursive_mutex> lock{ mutex };
+			collector_cv.wait(lock, [&] { return phase == collect_phase::idle; });
+		}
+		else if (phase != collect_phase::idle) {
+			collect_step(collect_budget::unlimited());
+		}
+		finish_sweep();
+	}
+
+	inline
+	void deferred_heap::compact(double max_occupancy)
+	{
+		Expects(0 <= max_occupancy && max_occupancy <= 1
+			&& "max_occupancy must be a fraction of a page");
+		collect();
+		finish_collection();
+
+		auto world = stop_the_world();
+		auto lock = lock_if_shared();
+		collecting_scope guard{ *this };
+		release_pages();
+
+		//	1. evacuate the sparsest pages first, into the densest pages; a page
+		//	that receives objects is not evacuated itself, so that no object
+		//	moves twice
+		//
+		std::vector<dhpage*> by_density;
+		for (auto& pg : pages) {
+			by_density.push_back(&pg);
+		}
+		std::sort(by_density.begin(), by_density.end(), [](auto a, auto b) {
+			return a->page.bytes_in_use() > b->page.bytes_in_use();
+		});
+
+		struct forward {
+			std::size_t size;
+			byte*		to;
+		};
+		std::map<const byte*, forward> forwarding;	// by old address
+		std::unordered_set<const dhpage*> targets;
+
+		//	(with conservative scanning, a raw pointer that can't be updated
+		//	may refer to any object, so none can move)
+		for (auto src = conservative_scan ? 0 : by_density.size(); src-- > 0; ) {
+			auto& pg = *by_density[src];
+			if (pg.page.bytes_in_use() >= max_occupancy * pg.page.extent().size()
+				|| targets.count(&pg) > 0) {
+				break;
+			}
+
+			for (auto where = 0; where < pg.page.locations(); ++where) {
+				if (!pg.page.location_info(where).is_start || pg.finalizing.get(where)) {
+					continue;
+				}
+				auto extent = pg.page.allocation_extent(where);
+				if (!pg.dtors.can_relocate(extent)) {
+					continue;
+				}
+
+				//	keep the objects at least as aligned as they are now
+				auto const address = reinterpret_cast<std::uintptr_t>(extent.data());
+				auto const align = std::min<std::size_t>(alignof(std::max_align_t),
+					address & (~address + 1));
+				auto const size = static_cast<std::size_t>(extent.size());
+
+				byte*	to	 = nullptr;
+				dhpage* dest = nullptr;
+				for (std::size_t dst = 0; dst < src && to == nullptr; ++dst) {
+					dest = by_density[dst];
+					if (dest->pointer_free != pg.pointer_free || dest->layout != pg.layout) {
+						continue;
 					}
+					//	(the allocation's extent includes its one-past-the-end location)
+					to = dest->page.allocate_bytes(size - pg.page.min_allocation(), align);
 				}
+				if (to == nullptr) {
+					continue;
+				}
+				targets.insert(dest);
+				dest->live_bytes += size;
+
+				pg.dtors.relocate(extent, to, dest->dtors);
+				pg.page.deallocate(extent.data());
+				forwarding.insert({ extent.data(), { size, to } });
 			}
 		}
 
-		//	We have now marked every allocation to save, so now
-		//	go through and clean up all the unreachable objects
-
-		//	3. reset all unreached deferred_ptrs to null
-		//
-		//	Note: 'const deferred_ptr' is supported and behaves as const w.r.t. the
-		//	the program code; however, a deferred_ptr data member can become
-		//	spontaneously null *during object destruction* even if declared
-		//	const to the rest of the program. So the collector is an exception
-		//	to constness, and the const_cast below is because any deferred_ptr must
-		//	be able to be set to null during collection, as part of safely
-		//	breaking cycles. (We could declare the data member mutable, but
-		//	then we might accidentally modify it in another const function.
-		//	Since a const deferred_ptr should only be reset in this one case, it's
-		//	more appropriate to avoid mutable and put the const_cast here.)
-		//
-		//	This is the same "don't touch other objects during finalization
-		//	because they may already have been finalized" rule as has evolved
-		//	in all cycle-breaking approaches. But, unlike the managed languages, here
-		//	the rule is actually directly supported and enforced (one object
-		//	being destroyed cannot touch another deferred-cleanup object by
-		//	accident because the deferred_ptr to that other object is null), it
-		//	removes the need for separate "finalizer" functions (we always run
-		//	real destructors, and only have to teach that deferred_ptrs might be null
-		//	in a destructor), and it eliminates the possibility of resurrection
-		//	(it is not possible for a destructor to make a collectable object
-		//	reachable again because we eliminate all pointers to it before any
-		//	user-defined destructor gets a chance to run). This is fully
-		//	compatible with learnings from existing approaches, but strictly
-		//	better in all these respects by directly enforcing those learnings
-		//	in the design, thus eliminating large classes of errors while also
-		//	minimizing complexity by inventing no new concepts other than
-		//	the rule "deferred_ptrs can be null in dtors."
+		//	2. point every deferred_ptr (and root range entry) to a moved object
+		//	at its new address (those inside moved objects were already
+		//	re-registered as copies)
 		//
-		for (auto& pg : pages) {
-			for (auto& dp : pg.deferred_ptrs) {
-				if (dp.level == 0) {
-					const_cast<deferred_ptr_void*>(dp.p)->reset();
+		auto relocated = [&](void* p) -> void* {
+			auto b = (const byte*)p;
+			if (b != nullptr) {
+				auto it = forwarding.upper_bound(b);
+				if (it != forwarding.begin() && b < (--it)->first + it->second.size) {
+					return it->second.to + (b - it->first);
+				}
+			}
+			return p;
+		};
+
+		auto fix = [&](const deferred_ptr_void* dp) {
+			auto p = relocated(dp->get());
+			if (p != dp->get()) {
+				store(*const_cast<deferred_ptr_void*>(dp), p);
+			}
+		};
+
+		if (!forwarding.empty()) {
+			for_each_root(fix);
+			for (auto r : root_ranges) {
+				for (auto& p : r->ptrs) {
+					p = relocated(p);
+				}
+			}
+			for (auto& pg : pages) {
+				for (auto dp : pg.deferred_ptrs) {
+					fix(dp);
+				}
+				if (pg.layout != nullptr) {
+					for (auto where = 0; where < pg.page.locations(); ++where) {
+						if (pg.page.location_info(where).is_start) {
+							for_each_laid_out(pg, where, [&](deferred_ptr_void& dp) { fix(&dp); });
+						}
+					}
 				}
 			}
 		}
 
-		//	4. deallocate all unreachable allocations, running
-		//	destructors if registered
+		//	3. release the evacuated pages
 		//
+		drop_empty_pages();
+	}
+
+	inline
+	std::size_t deferred_heap::heap_bytes() const
+	{
+		auto world = stop_the_world();
+		auto lock = lock_if_shared();
+		std::size_t total = 0;
 		for (auto& pg : pages) {
-			for (auto i = 0; i < pg.page.locations(); ++i) {
-				auto start = pg.page.location_info(i);
-				if (start.is_start && !pg.live_starts.get(i)) {
-					//	this is an allocation to destroy and deallocate
-
-					//	find the end of the allocation
-					auto end_i = i + 1;
-					auto end = [](auto s) { return s.data() + s.size(); }(pg.page.extent());
-					for (; end_i < pg.page.locations(); ++end_i) {
-						auto info = pg.page.location_info(end_i);
-						if (info.is_start) {
-							end = info.pointer;
-							break;
-						}
-					}
+			total += pg.page.extent().size();
+		}
+		return total;
+	}
+
+	inline
+	std::size_t deferred_heap::destructor_count() const
+	{
+		auto world = stop_the_world();
+		auto lock = lock_if_shared();
+		std::size_t n = 0;
+		for (auto& pg : pages) {
+			n += pg.dtors.size();
+		}
+		return n;
+	}
+
+	inline
+	std::size_t deferred_heap::destructor_bytes() const
+	{
+		auto world = stop_the_world();
+		auto lock = lock_if_shared();
+		std::size_t n = 0;
+		for (auto& pg : pages) {
+			n += pg.dtors.bytes();
+		}
+		return n;
+	}
+
+	inline
+	double deferred_heap::fragmentation() const
+	{
+		auto world = stop_the_world();
+		auto lock = lock_if_shared();
+		std::size_t total = 0, in_use = 0;
+		for (auto& pg : pages) {
+			total  += pg.page.extent().size();
+			in_use += pg.page.bytes_in_use();
+		}
+		return total == 0 ? 0.0 : 1.0 - static_cast<double>(in_use) / total;
+	}
+
+	inline
+	void deferred_heap::finish_sweep()
+	{
+		auto world = stop_the_world();
+		auto lock = lock_if_shared();
+		collecting_scope guard{ *this };
+		sweep_all();
+	}
+
+	inline
+	void deferred_heap::set_lazy_sweep(bool enable)
+	{
+		finish_collection();
+		lazy_sweep = enable;
+	}
+
+	inline
+	void deferred_heap::set_conservative_scan(bool enable)
+	{
+		auto world = stop_the_world();
+		auto lock = lock_if_shared();
+		Expects(pages.empty()
+			&& "conservative scanning can only be changed while the heap has no pages");
+		Expects((!enable || !collector.joinable())
+			&& "conservative scanning cannot be used with a background collector");
+		conservative_scan = enable;
+	}
+
+	inline
+	void deferred_heap::set_generational(bool enable)
+	{
+		finish_collection();
+
+		//	all existing objects start out old
+		auto world = stop_the_world();
+		release_pages();
+		auto remembered = remembers();
+		generational = enable;
+		for (auto& pg : pages) {
+			pg.nursery = false;
+		}
+		if (remembers() != remembered) {
+			rebuild_remembered_sets();
+		}
+	}
+
+	inline
+	void deferred_heap::set_region_collection(bool enable)
+	{
+		finish_collection();
+
+		auto world = stop_the_world();
+		auto remembered = remembers();
+		region_collection = enable;
+		if (remembers() != remembered) {
+			rebuild_remembered_sets();
+		}
+	}
+
+	inline
+	void deferred_heap::collect_minor()
+	{
+		Expects(generational && "collect_minor() requires generational mode");
+		finish_collection();
+
+		auto world = stop_the_world();
+		std::unique_lock<std::recursive_mutex> lock{ mutex, std::defer_lock };
+		if (collector.joinable() || finalizer.joinable()) {
+			lock.lock();
+		}
+		start_cycle(cycle_kind::minor);
+		collect_step(collect_budget::unlimited());
+	}
+
+	inline
+	void deferred_heap::collect_regions(int max_pages)
+	{
+		Expects(max_pages > 0 && "collect_regions() must be allowed at least one page");
+		Expects(remembers() && "collect_regions() requires region collection or generational mode");
+		finish_collection();
+
+		auto world = stop_the_world();
+		std::unique_lock<std::recursive_mutex> lock{ mutex, std::defer_lock };
+		if (collector.joinable() || finalizer.joinable()) {
+			lock.lock();
+		}
+
+		//	condemn the pages with the most estimated garbage
+		auto garbage = [](const dhpage* pg) {
+			auto in_use = pg->page.bytes_in_use();
+			return in_use > pg->live_bytes ? in_use - pg->live_bytes : 0;
+		};
+
+		//	(a page that the last partial cycle found to have no garbage can
+		//	still hold part of a garbage cycle that spans pages, so pages with
+		//	no estimated garbage are candidates too, just the last ones)
+		std::vector<dhpage*> candidates;
+		auto any_garbage = false;
+		for (auto& pg : pages) {
+			pg.condemned = false;
+			candidates.push_back(&pg);
+			any_garbage = any_garbage || garbage(&pg) > 0;
+		}
+		if (!any_garbage) {
+			return;
+		}
+
+		auto n = std::min<std::size_t>(max_pages, candidates.size());
+		std::partial_sort(candidates.begin(), candidates.begin() + n, candidates.end(),
+			[&](auto a, auto b) { return garbage(a) > garbage(b); });
+		for (std::size_t i = 0; i < n; ++i) {
+			candidates[i]->condemned = true;
+		}
+
+		start_cycle(cycle_kind::regions);
+		collect_step(collect_budget::unlimited());
+	}
 
-					// call the destructors for objects in this range
-					destroy_objects({ start.pointer, end });
+	inline
+	void deferred_heap::set_background_collector(bool enable)
+	{
+		if (enable && !collector.joinable()) {
+			Expects(!thread_safe && "a background collector cannot be used in thread-safe mode");
+			Expects(!conservative_scan && "a background collector cannot be used with conservative scanning");
+			finish_collection();
+			stop_collector = false;
+			collector = std::thread{ [this] { run_collector(); } };
+		}
+		else if (!enable && collector.joinable()) {
+			{
+				std::lock_guard<std::recursive_mutex> lock{ mutex };
+				stop_collector = true;
+			}
+			collector_cv.notify_all();
+			collector.join();
+		}
+	}
+
+	//	The background collector thread: wait for collect() to start a cycle,
+	//	then run it to completion in short steps, letting the mutator in
+	//	between steps. Any cycle in progress is finished before stopping.
+	//
+	inline
+	void deferred_heap::run_collector()
+	{
+		std::unique_lock<std::recursive_mutex> lock{ mutex };
+		for (;;) {
+			collector_cv.wait(lock, [&] { return stop_collector || phase != collect_phase::idle; });
+			if (phase == collect_phase::idle) {
+				return;
+			}
+
+			while (phase != collect_phase::idle
+				&& !collect_step(collect_budget::of_time(std::chrono::microseconds(50)))) {
+				lock.unlock();
+				std::this_thread::yield();
+				lock.lock();
+			}
+			collector_cv.notify_all();
+		}
+	}
+
+	inline
+	void deferred_heap::set_deferred_finalization(bool enable)
+	{
+		if (!enable) {
+			set_finalizer_thread(false);
+			finish_collection();
+			deferred_finalization = false;
+			drain_finalizers();
+		}
+		else {
+			Expects(!thread_safe && "deferred finalization cannot be used in thread-safe mode");
+			finish_collection();
+			deferred_finalization = true;
+		}
+	}
+
+	inline
+	void deferred_heap::set_finalizer_thread(bool enable)
+	{
+		if (enable && !finalizer.joinable()) {
+			Expects(!thread_safe && "deferred finalization cannot be used in thread-safe mode");
+			finish_collection();
+			deferred_finalization = true;
+			stop_finalizer = false;
+			finalizer = std::thread{ [this] { run_finalizer(); } };
+		}
+		else if (!enable && finalizer.joinable()) {
+			{
+				std::lock_guard<std::recursive_mutex> lock{ mutex };
+				stop_finalizer = true;
+			}
+			finalizer_cv.notify_all();
+			finalizer.join();
+		}
+	}
 
-					// and then deallocate the raw storage
-					pg.page.deallocate(start.pointer);
+	//	Run the oldest queued batch of destructors, then deallocate their
+	//	objects' storage and add them to objects and bytes. Returns false if
+	//	there was no batch to run.
+	//
+	//	The batch runs without the heap mutex: its objects are unreachable,
+	//	and no cycle or compaction touches allocations that are finalizing,
+	//	so nothing else can be using them. This also lets the destructors use
+	//	the heap normally, including to collect it.
+	//
+	inline
+	bool deferred_heap::finalize_one(std::size_t& objects, std::size_t& bytes)
+	{
+		std::list<finalization> f;
+		{
+			auto lock = lock_if_shared();
+			if (finalizers.empty()) {
+				return false;
+			}
+			f.splice(f.begin(), finalizers, finalizers.begin());
+			++finalizers_running;
+		}
+
+		f.front().batch.run();
+
+		{
+			auto lock = lock_if_shared();
+			auto& pg = *f.front().page;
+			for (auto where : f.front().starts) {
+				auto extent = pg.page.allocation_extent(where);
+				pg.page.deallocate(extent.data());
+				pg.finalizing.set(where, false);
+				bytes += extent.size();
+				++objects;
+			}
+			--finalizers_running;
+		}
+		finalizer_cv.notify_all();
+		return true;
+	}
+
+	inline
+	bool deferred_heap::drain_finalizers(collect_budget budget)
+	{
+		using clock = collect_budget::clock;
+		auto const timed    = budget.time != clock::duration::max();
+		auto const deadline = timed ? clock::now() + budget.time : clock::time_point::max();
+		std::size_t objects = 0, bytes = 0;
+
+		auto exhausted = [&] {
+			return objects > 0
+				&& (objects >= budget.objects
+					|| bytes >= budget.bytes
+					|| (timed && clock::now() >= deadline));
+		};
+
+		while (!exhausted()) {
+			if (!finalize_one(objects, bytes)) {
+				//	wait for any batch that the finalizer thread is running
+				//	(unless this is that thread, e.g. in a destructor)
+				auto lock = lock_if_shared();
+				if (finalizer.joinable() && std::this_thread::get_id() != finalizer.get_id()) {
+					finalizer_cv.wait(lock, [&] { return finalizers_running == 0; });
 				}
+				return finalizers.empty();
 			}
 		}
 
-		//	5. finally, drop all now-unused pages
-		//
-		auto empty = pages.begin();
-		while ((empty = std::find_if(pages.begin(), pages.end(),
-							[](const auto& pg) { return pg.page.is_empty(); }))
-				!= pages.end()) {
-			Ensures(empty->deferred_ptrs.empty() && "page with no allocations still has deferred_ptrs");
-			pages.erase(empty);
+		auto lock = lock_if_shared();
+		return finalizers.empty() && finalizers_running == 0;
+	}
+
+	//	The finalizer thread: wait for sweeping to queue destructors, and run
+	//	them. Any queued destructors are run before stopping.
+	//
+	inline
+	void deferred_heap::run_finalizer()
+	{
+		std::unique_lock<std::recursive_mutex> lock{ mutex };
+		for (;;) {
+			finalizer_cv.wait(lock, [&] { return stop_finalizer || !finalizers.empty(); });
+			if (finalizers.empty()) {
+				return;
+			}
+
+			lock.unlock();
+			std::size_t objects = 0, bytes = 0;
+			finalize_one(objects, bytes);
+			lock.lock();
 		}
 	}
 
 	inline
 	void destructors::debug_print() const {
-		std::cout << "\n  destructors size() is " << dtors.size() << "\n";
+		std::cout << "\n  destructors size() is " << size() << " in " << dtors.size() << " records\n";
 		for (auto& d : dtors) {
-			std::cout << "    " << (void*)(d.p) << ", " << (void*)(d.destroy) << "\n";
+			std::cout << "    " << (void*)(d.p) << " x " << d.count << ", " << (void*)(d.destroy_n) << "\n";
 		}
 		std::cout << "\n";
 	}
@@ -1089,24 +4223,31 @@ namespace gcpp {
 	inline
 	void deferred_heap::debug_print() const
 	{
+		auto world = stop_the_world();
+		auto lock = lock_if_shared();
 		std::cout << "\n*** heap snapshot [" << (void*)this << "] *** "
 			<< pages.size() << " page" << (pages.size() != 1 ? "s *" : " **")
 			<< "***********************************\n\n";
 		for (auto& pg : pages) {
+			if (pg.nursery) {
+				std::cout << "(nursery) ";
+			}
+			if (pg.unswept) {
+				std::cout << "(unswept) ";
+			}
 			pg.page.debug_print();
+			std::cout << "\n  estimated live bytes " << pg.live_bytes
+				<< ", incoming deferred_ptrs " << pg.incoming.size() << "\n";
 			std::cout << "\n  this page's deferred_ptrs.size() is " << pg.deferred_ptrs.size() << "\n";
 			for (auto& dp : pg.deferred_ptrs) {
-				std::cout << "    " << (void*)dp.p << " -> " << dp.p->get()
-					<< ", level " << dp.level << "\n";
+				std::cout << "    " << (void*)dp << " -> " << dp->get() << "\n";
 			}
-			std::cout << "\n";
+			pg.dtors.debug_print();
 		}
-		std::cout << "  roots.size() is " << roots.size()
-				  << ", load_factor is " << roots.load_factor() << "\n";
-		for (auto& p : roots) {
+		std::cout << "  roots.size() is " << roots.size() << "\n";
+		for_each_root([](auto p) {
 			std::cout << "    " << (void*)p << " -> " << p->get() << "\n";
-		}
-		dtors.debug_print();
+		});
 	}
 
 }
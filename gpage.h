@@ -40,9 +40,10 @@ namespace gcpp {
 	//  total_size	Total page size (page does not grow)
 	//  min_alloc	Minimum allocation size in bytes
 	//
-	//	storage		Underlying storage bytes
+	//	storage		Underlying storage bytes, owned unless provided by the caller
 	//  inuse		Tracks whether location is in use: false = unused, true = used
 	//  starts		Tracks whether location starts an allocation: false = no, true = yes
+	//	allocations	Number of current allocations
 	//
 	//	current_known_request_bound		Cached hint about largest current hole
 	//
@@ -50,11 +51,22 @@ namespace gcpp {
 
 	class gpage {
 	private:
+		struct storage_deleter {
+			bool owned;
+			void operator()(byte* p) const noexcept {
+				if (owned) {
+					delete[] p;
+				}
+			}
+		};
+
 		const std::size_t				total_size;
 		const std::size_t				min_alloc;
-		const std::unique_ptr<byte[]>	storage;
+		const std::unique_ptr<byte[], storage_deleter>
+										storage;
 		bitflags						inuse;
 		bitflags						starts;
+		int								allocations = 0;
 		std::size_t						current_known_request_bound = total_size;
 
 		//	Copy and move are disabled by const unique_ptr member, but let's be explicit
@@ -65,6 +77,8 @@ namespace gcpp {
 	public:
 		int locations() const noexcept { return gsl::narrow_cast<int>(total_size / min_alloc); }
 
+		std::size_t min_allocation() const noexcept { return min_alloc; }
+
 		gsl::span<const byte> extent() const noexcept {
 			return { storage.get(), gsl::narrow_cast<std::ptrdiff_t>(total_size) };
 		}
@@ -72,21 +86,41 @@ namespace gcpp {
 			return { storage.get(), gsl::narrow_cast<std::ptrdiff_t>(total_size) };
 		}
 
+		std::size_t bytes_in_use() const noexcept {
+			return inuse.count() * min_alloc;
+		}
+
+		int allocation_count() const noexcept { return allocations; }
+
 		bool is_empty() const noexcept {
-			auto ret = inuse.all_false();
-			Ensures((!ret || starts.all_false()) && "gpage with no inuse still has starts");
-			return ret;
+			return allocations == 0;
 		}
 
 		//	Construct a page with a given size and chunk size
 		//
 		gpage(std::size_t total_size_ = 1024, std::size_t min_alloc_ = 4);
 
+		//	Construct a page over storage owned by the caller, which must hold
+		//	rounded_size(total_size_, min_alloc_) bytes and outlive the page
+		//
+		gpage(std::size_t total_size_, std::size_t min_alloc_, byte* storage_);
+
+		static std::size_t rounded_size(std::size_t total_size_, std::size_t min_alloc_) noexcept {
+			return total_size_ + (total_size_ % min_alloc_ > 0
+				? min_alloc_ - (total_size_ % min_alloc_)
+				: 0);
+		}
+
 		//  Allocate space for n objects of type T
 		//
 		template<class T>
 		byte* allocate(int n = 1) noexcept;
 
+		//  Allocate raw space of at least bytes_needed bytes at an address
+		//	that is a multiple of align (a power of two)
+		//
+		byte* allocate_bytes(std::size_t bytes_needed, std::size_t align) noexcept;
+
 		//  Return whether p points into this page's storage and is allocated.
 		//
 		bool contains(gsl::not_null<const byte*> p) const noexcept;
@@ -114,11 +148,19 @@ namespace gcpp {
 		location_info_ret
 		location_info(int where) const noexcept;
 
+		//  Return the storage of the allocation that starts at location where.
+		//
+		gsl::span<byte> allocation_extent(int where) const noexcept;
+
 		//  Deallocate the allocation that starts at *p.
 		//	Note: p must be a pointer previously returned by allocate().
 		//
 		void deallocate(gsl::not_null<byte*> p) noexcept;
 
+		//  Deallocate every allocation at once.
+		//
+		void deallocate_all() noexcept;
+
 		//	Debugging support
 		//
 		void debug_print() const;
@@ -136,13 +178,16 @@ namespace gcpp {
 	//
 	inline
 	gpage::gpage(std::size_t total_size_, std::size_t min_alloc_)
+		: gpage(total_size_, min_alloc_, nullptr)
+	{ }
+
+	inline
+	gpage::gpage(std::size_t total_size_, std::size_t min_alloc_, byte* storage_)
 		//	total_size must be a multiple of min_alloc, so round up if necessary
-		: total_size(total_size_ +
-			(total_size_ % min_alloc_ > 0
-			? min_alloc_ - (total_size_ % min_alloc_)
-			: 0))
+		: total_size(rounded_size(total_size_, min_alloc_))
 		, min_alloc(min_alloc_)
-		, storage(std::make_unique<byte[]>(total_size))
+		, storage(storage_ != nullptr ? storage_ : new byte[total_size](),
+				  storage_deleter{ storage_ == nullptr })
 		, inuse(locations(), false)
 		, starts(locations(), false)
 	{
@@ -164,7 +209,17 @@ namespace gcpp {
 			std::numeric_limits<std::size_t>::max() / sizeof(T) &&
 			"sizeof(T)*n must be representable by std::size_t");
 
-		const auto bytes_needed = sizeof(T)*n;
+		return allocate_bytes(sizeof(T)*n, alignof(T));
+	}
+
+
+	//  Allocate raw space of at least bytes_needed bytes at an address
+	//	that is a multiple of align (a power of two)
+	//
+	inline
+	byte* gpage::allocate_bytes(std::size_t bytes_needed, std::size_t align) noexcept {
+		Expects(bytes_needed > 0 && "cannot request an empty allocation");
+		Expects(align > 0 && (align & (align - 1)) == 0 && "alignment must be a power of two");
 
 		//	optimization: if we know we don't have room, don't even scan
 		if (bytes_needed > current_known_request_bound) {
@@ -175,12 +230,14 @@ namespace gcpp {
 		//	because of alignment requirements, and also whether the request can fit
 		void* aligned_start = storage.get();
 		auto  aligned_space = total_size;
-		if (std::align(alignof(T), bytes_needed, aligned_start, aligned_space) == nullptr) {
+		if (std::align(align, bytes_needed, aligned_start, aligned_space) == nullptr) {
 			return nullptr;	// page can't have enough space for this #bytes, after alignment
 		}
 
-		//	alignment of location needed by a T
-		const auto locations_step = 1 + (alignof(T)-1) / min_alloc;
+		//	alignment of location needed: step by enough locations that every
+		//	candidate's offset is a multiple of align
+		const auto min_alloc_align = min_alloc & (~min_alloc + 1);	// lowest set bit
+		const auto locations_step = align > min_alloc_align ? align / min_alloc_align : 1;
 
 		//	# contiguous locations needed total
 		//	note: as a simplification, for now we just add an extra location to every
@@ -222,6 +279,7 @@ namespace gcpp {
 		//	otherwise, allocate it: mark the start and now-used locations...
 		starts.set(i, true);							// mark that 'i' begins an allocation
 		inuse.set(i, i + locations_needed, true);
+		++allocations;
 
 		//	optimization: remember that we have this much less memory free
 		current_known_request_bound -= min_alloc * locations_needed;
@@ -275,6 +333,19 @@ namespace gcpp {
 	}
 
 
+	//  Return the storage of the allocation that starts at location where,
+	//	which runs up to the next start or the next unused location,
+	//	whichever comes first.
+	//
+	inline
+	gsl::span<byte> gpage::allocation_extent(int where) const noexcept {
+		Expects(starts.get(where) && "allocation_extent() - not at start of a valid allocation");
+		auto next_start = starts.find_next(where + 1, locations(), true);
+		auto end = inuse.find_next(where + 1, next_start, false);
+		return{ &storage[where*min_alloc], gsl::narrow_cast<std::ptrdiff_t>((end - where)*min_alloc) };
+	}
+
+
 	//  Deallocate space for object(s) of type T
 	//
 	inline
@@ -291,6 +362,7 @@ namespace gcpp {
 
 		// reset 'starts' to erase the record of the start of this allocation
 		starts.set(here, false);
+		--allocations;
 
 		// scan 'starts' to find the start of the following allocation, if any
 		//	TODO replace this loop with a function call
@@ -316,6 +388,16 @@ namespace gcpp {
 		}
 	}
 
+	//  Deallocate every allocation at once.
+	//
+	inline
+	void gpage::deallocate_all() noexcept {
+		inuse.set_all(false);
+		starts.set_all(false);
+		allocations = 0;
+		current_known_request_bound = total_size;
+	}
+
 
 	//	Debugging support
 	//
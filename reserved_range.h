@@ -0,0 +1,147 @@
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2016 Herb Sutter. All rights reserved.
+//
+// This code is licensed under the MIT License (MIT).
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef GCPP_RESERVED_RANGE
+#define GCPP_RESERVED_RANGE
+
+#include "util.h"
+
+#include <new>
+#include <cstddef>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace gcpp {
+
+	//----------------------------------------------------------------------------
+	//
+	//	reserved_range - A contiguous range of virtual addresses, reserved up
+	//	front but not backed by memory until parts of it are committed.
+	//
+	//	commit and decommit work in whole OS pages, so the ranges passed to
+	//	them must be multiples of granularity(). Running out of addresses or
+	//	memory throws bad_alloc.
+	//
+	//----------------------------------------------------------------------------
+
+	class reserved_range {
+		byte*		base = nullptr;
+		std::size_t total_size;
+
+		reserved_range(reserved_range&) = delete;
+		void operator=(reserved_range&) = delete;
+
+	public:
+		explicit reserved_range(std::size_t bytes);
+		~reserved_range();
+
+		gsl::span<byte> extent() const noexcept {
+			return{ base, gsl::narrow_cast<std::ptrdiff_t>(total_size) };
+		}
+
+		static std::size_t granularity() noexcept;
+
+		void commit(byte* p, std::size_t n);
+		void decommit(byte* p, std::size_t n) noexcept;
+	};
+
+
+	//----------------------------------------------------------------------------
+	//
+	//	reserved_range function implementations
+	//
+	//----------------------------------------------------------------------------
+	//
+	inline
+	std::size_t reserved_range::granularity() noexcept {
+#ifdef _WIN32
+		SYSTEM_INFO info;
+		GetSystemInfo(&info);
+		return info.dwPageSize;
+#else
+		return static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+#endif
+	}
+
+	inline
+	reserved_range::reserved_range(std::size_t bytes)
+		: total_size{ bytes }
+	{
+		Expects(bytes > 0 && bytes % granularity() == 0
+			&& "a reservation must be a positive multiple of the OS page size");
+#ifdef _WIN32
+		base = static_cast<byte*>(VirtualAlloc(nullptr, bytes, MEM_RESERVE, PAGE_NOACCESS));
+#else
+		auto p = mmap(nullptr, bytes, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		base = p != MAP_FAILED ? static_cast<byte*>(p) : nullptr;
+#endif
+		if (base == nullptr) {
+			throw std::bad_alloc{};
+		}
+	}
+
+	inline
+	reserved_range::~reserved_range() {
+#ifdef _WIN32
+		VirtualFree(base, 0, MEM_RELEASE);
+#else
+		munmap(base, total_size);
+#endif
+	}
+
+	//	Back [p, p+n) with zeroed memory
+	//
+	inline
+	void reserved_range::commit(byte* p, std::size_t n) {
+		Expects(base <= p && n <= total_size - (p - base)
+			&& "cannot commit outside the reservation");
+#ifdef _WIN32
+		auto ok = VirtualAlloc(p, n, MEM_COMMIT, PAGE_READWRITE) != nullptr;
+#else
+		auto ok = mprotect(p, n, PROT_READ | PROT_WRITE) == 0;
+#endif
+		if (!ok) {
+			throw std::bad_alloc{};
+		}
+	}
+
+	//	Return [p, p+n)'s memory to the OS, keeping the addresses reserved
+	//
+	inline
+	void reserved_range::decommit(byte* p, std::size_t n) noexcept {
+		Expects(base <= p && n <= total_size - (p - base)
+			&& "cannot decommit outside the reservation");
+#ifdef _WIN32
+		VirtualFree(p, n, MEM_DECOMMIT);
+#else
+		madvise(p, n, MADV_DONTNEED);
+		mprotect(p, n, PROT_NONE);
+#endif
+	}
+
+}
+
+#endif
@@ -0,0 +1,838 @@
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2016 Herb Sutter. All rights reserved.
+//
+// This code is licensed under the MIT License (MIT).
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef GCPP_TAGGED_HEAP
+#define GCPP_TAGGED_HEAP
+
+#include "deferred_heap.h"
+#include "reserved_range.h"
+
+#include <vector>
+#include <list>
+#include <map>
+#include <utility>
+#include <unordered_set>
+#include <algorithm>
+#include <type_traits>
+#include <cstddef>
+#include <cstdint>
+
+namespace gcpp {
+
+	template<class Tag> class tagged_heap;
+
+	//----------------------------------------------------------------------------
+	//
+	//	tagged_ptr<T, Tag> - A pointer to an object in the tagged_heap<Tag>.
+	//
+	//	This is the statically tagged alternative described in deferred_ptr_void:
+	//	the heap is identified by the Tag type rather than by a back pointer, so
+	//	a tagged_ptr is just a raw pointer. It is trivially copyable and not
+	//	registered anywhere, and a tagged_ptr into one heap cannot be assigned
+	//	from a tagged_ptr into another (that doesn't compile).
+	//
+	//	Because tagged_ptrs are not registered, the heap finds them by tracing
+	//	instead: see tagged_heap.
+	//
+	//----------------------------------------------------------------------------
+	//
+	template<class T, class Tag>
+	class tagged_ptr {
+		T* p = nullptr;
+
+		explicit tagged_ptr(T* p_) noexcept
+			: p{ p_ }
+		{ }
+
+		friend tagged_heap<Tag>;
+
+		template<class U, class Tag2>
+		friend class tagged_ptr;
+
+		template<class U, class Tag2>
+		friend class tagged_root;
+
+		template<class U, class Tag2>
+		friend class compressed_ptr;
+
+	public:
+		using element_type = T;
+
+		tagged_ptr() = default;
+
+		tagged_ptr(std::nullptr_t) noexcept
+		{ }
+
+		//	Copying from a tagged_ptr to a derived type in the same heap
+		//
+		template<class U,
+			class = std::enable_if_t<std::is_convertible<U*, T*>::value>>
+		tagged_ptr(const tagged_ptr<U, Tag>& that) noexcept
+			: p{ that.p }
+		{ }
+
+		//	Accessors.
+		//
+		T* get() const noexcept {
+			return p;
+		}
+
+		void reset() noexcept {
+			p = nullptr;
+		}
+
+		explicit operator bool() const noexcept { return p != nullptr; }
+
+		std::add_lvalue_reference_t<T> operator*() const noexcept {
+			Expects(p && "attempt to dereference null");
+			return *p;
+		}
+
+		T* operator->() const noexcept {
+			Expects(p && "attempt to dereference null");
+			return p;
+		}
+
+		std::add_lvalue_reference_t<T> operator[](std::size_t offset) const noexcept {
+			Expects(p && "attempt to dereference null");
+			return p[offset];
+		}
+
+		int compare3(const tagged_ptr& that) const { return p < that.p ? -1 : p == that.p ? 0 : 1; };
+		GCPP_TOTALLY_ORDERED_COMPARISON(tagged_ptr);
+	};
+
+
+	//----------------------------------------------------------------------------
+	//
+	//	compressed_ptr<T, Tag> - A tagged_ptr stored in 32 bits.
+	//
+	//	It holds its target's offset from the start of the heap's reserved
+	//	address range in units of 8 bytes, so it can address a reservation of
+	//	up to 32 GB, and get() decompresses it with a shift and one add. Its
+	//	tagged_heap<Tag> must have been constructed with a reservation, and
+	//	the target must be 8-byte aligned, as every allocation there is.
+	//	Offset 0 is null, as nothing is allocated at the start of the
+	//	reservation.
+	//
+	//	Objects trace their compressed_ptrs just as they trace tagged_ptrs.
+	//
+	//----------------------------------------------------------------------------
+	//
+	template<class T, class Tag>
+	class compressed_ptr {
+		std::uint32_t offset = 0;
+
+		template<class U, class Tag2>
+		friend class compressed_ptr;
+
+		static constexpr int shift = tagged_heap<Tag>::compressed_shift;
+
+		static std::uint32_t compress(const T* p) noexcept {
+			if (p == nullptr) {
+				return 0;
+			}
+			auto base = tagged_heap<Tag>::compressed_base;
+			Expects(base != nullptr && "compressed_ptrs need a tagged_heap with a reservation");
+			auto bytes = (const byte*)p - base;
+			Expects(bytes > 0 && bytes % (1 << shift) == 0
+				&& static_cast<std::size_t>(bytes >> shift) <= std::numeric_limits<std::uint32_t>::max()
+				&& "a compressed_ptr must point to an aligned location in its heap's reservation");
+			return static_cast<std::uint32_t>(bytes >> shift);
+		}
+
+	public:
+		using element_type = T;
+
+		compressed_ptr() = default;
+
+		compressed_ptr(std::nullptr_t) noexcept
+		{ }
+
+		//	Compressing a tagged_ptr, or copying from a compressed_ptr, to the
+		//	same or a derived type in the same heap
+		//
+		template<class U,
+			class = std::enable_if_t<std::is_convertible<U*, T*>::value>>
+		compressed_ptr(const tagged_ptr<U, Tag>& that) noexcept
+			: offset{ compress(that.get()) }
+		{ }
+
+		template<class U,
+			class = std::enable_if_t<std::is_convertible<U*, T*>::value>>
+		compressed_ptr(const compressed_ptr<U, Tag>& that) noexcept
+			: offset{ compress(that.get()) }
+		{ }
+
+		//	Decompressing to a tagged_ptr
+		//
+		template<class U,
+			class = std::enable_if_t<std::is_convertible<T*, U*>::value>>
+		operator tagged_ptr<U, Tag>() const noexcept {
+			return tagged_ptr<U, Tag>{ get() };
+		}
+
+		//	Accessors.
+		//
+		T* get() const noexcept {
+			return offset == 0 ? nullptr : reinterpret_cast<T*>(
+				tagged_heap<Tag>::compressed_base + (std::size_t{ offset } << shift));
+		}
+
+		void reset() noexcept {
+			offset = 0;
+		}
+
+		explicit operator bool() const noexcept { return offset != 0; }
+
+		std::add_lvalue_reference_t<T> operator*() const noexcept {
+			Expects(offset && "attempt to dereference null");
+			return *get();
+		}
+
+		T* operator->() const noexcept {
+			Expects(offset && "attempt to dereference null");
+			return get();
+		}
+
+		std::add_lvalue_reference_t<T> operator[](std::size_t i) const noexcept {
+			Expects(offset && "attempt to dereference null");
+			return get()[i];
+		}
+
+		int compare3(const compressed_ptr& that) const { return offset < that.offset ? -1 : offset == that.offset ? 0 : 1; };
+		GCPP_TOTALLY_ORDERED_COMPARISON(compressed_ptr);
+	};
+
+
+	//----------------------------------------------------------------------------
+	//
+	//	tagged_root<T, Tag> - A tagged_ptr that keeps its object alive.
+	//
+	//	Collection traces from the tagged_roots, which (unlike tagged_ptrs) do
+	//	register with their heap, just as a deferred_ptr outside a deferred_heap
+	//	does. Any pointer outside the heap that must stay valid across a
+	//	collect() has to be a tagged_root. A tagged_root must not be stored in
+	//	an object in the heap, where it would keep its object alive forever.
+	//
+	//----------------------------------------------------------------------------
+	//
+	template<class T, class Tag>
+	class tagged_root : public tagged_heap<Tag>::root_void {
+		using base = typename tagged_heap<Tag>::root_void;
+
+	public:
+		tagged_root(tagged_ptr<T, Tag> p = nullptr)
+			: base{ const_cast<std::remove_cv_t<T>*>(p.get()) }
+		{ }
+
+		tagged_root& operator=(tagged_ptr<T, Tag> p) noexcept {
+			this->p = const_cast<std::remove_cv_t<T>*>(p.get());
+			return *this;
+		}
+
+		//	Accessors.
+		//
+		T* get() const noexcept {
+			return static_cast<T*>(this->p);
+		}
+
+		operator tagged_ptr<T, Tag>() const noexcept {
+			return tagged_ptr<T, Tag>{ get() };
+		}
+
+		void reset() noexcept {
+			this->p = nullptr;
+		}
+
+		explicit operator bool() const noexcept { return this->p != nullptr; }
+
+		std::add_lvalue_reference_t<T> operator*() const noexcept {
+			Expects(get() && "attempt to dereference null");
+			return *get();
+		}
+
+		T* operator->() const noexcept {
+			Expects(get() && "attempt to dereference null");
+			return get();
+		}
+	};
+
+
+	//----------------------------------------------------------------------------
+	//
+	//	tagged_heap<Tag> - A deferred heap identified statically by Tag, whose
+	//	pointers are tagged_ptr<T, Tag>s. Only one tagged_heap<Tag> may exist
+	//	at a time for each Tag.
+	//
+	//	Since tagged_ptrs are not registered, every type allocated here that
+	//	contains tagged_ptrs (directly, or in members such as containers) must
+	//	provide a member function template
+	//
+	//		template<class Tracer> void trace(Tracer& t) { t(next); t(other); }
+	//
+	//	that calls t for each of them. make<T> records trace for each object,
+	//	so the only bookkeeping is per allocation, not per pointer copy. A type
+	//	without trace is assumed to contain no tagged_ptrs.
+	//
+	//	Collection is stop-the-world, and happens only in collect(), so between
+	//	collections tagged_ptrs outside the heap need no root. As in
+	//	deferred_heap, all the tagged_ptrs in an unreachable object are reset
+	//	to null before any of the unreachable objects' destructors run.
+	//
+	//	A heap constructed with a number of bytes to reserve allocates all of
+	//	its pages within one contiguous reservation of address space of that
+	//	size, which lets its objects hold compressed_ptrs.
+	//
+	//----------------------------------------------------------------------------
+	//
+	template<class Tag>
+	class tagged_heap {
+		template<class T, class Tag2>
+		friend class tagged_root;
+
+		template<class T, class Tag2>
+		friend class compressed_ptr;
+
+		//	Disable copy and move
+		tagged_heap(tagged_heap&)	   = delete;
+		void operator=(tagged_heap&) = delete;
+
+		static tagged_heap* current;	// the heap for Tag, if there is one
+		static byte* compressed_base;	// its reservation, if it has one
+		static constexpr int compressed_shift = 3;	// compressed_ptr units are 8 bytes
+
+		//------------------------------------------------------------------------
+		//
+		//	root_void is the generic root type we track internally; the user
+		//	uses tagged_root<T, Tag>, the type-casting wrapper.
+		//
+		class root_void {
+			friend tagged_heap;
+
+		protected:
+			void* p;
+
+			root_void(void* p_)
+				: p{ p_ }
+			{
+				Expects(current != nullptr && "no tagged_heap exists for this tag");
+				current->roots.insert(this);
+			}
+
+			root_void(const root_void& that)
+				: root_void{ that.p }
+			{ }
+
+			root_void& operator=(const root_void& that) noexcept {
+				p = that.p;
+				return *this;
+			}
+
+			~root_void() {
+				//	no need to deregister if the heap is already gone
+				if (current != nullptr) {
+					current->roots.erase(this);
+				}
+			}
+		};
+
+		//------------------------------------------------------------------------
+		//
+		//	tracer visits the tagged_ptrs in an object, via the object's trace
+		//	function, either to shade their targets (while marking) or to reset
+		//	them (before the object is destroyed)
+		//
+		class tracer {
+			tagged_heap& heap;
+			bool		 resetting;
+
+		public:
+			tracer(tagged_heap& heap_, bool resetting_)
+				: heap{ heap_ }
+				, resetting{ resetting_ }
+			{ }
+
+			template<class U>
+			void operator()(tagged_ptr<U, Tag>& p) {
+				if (resetting) {
+					p.reset();
+				}
+				else {
+					heap.shade(p.get());
+				}
+			}
+
+			template<class U>
+			void operator()(compressed_ptr<U, Tag>& p) {
+				if (resetting) {
+					p.reset();
+				}
+				else {
+					heap.shade(p.get());
+				}
+			}
+		};
+
+		template<class T, class = void>
+		struct is_traced : std::false_type { };
+
+		template<class T>
+		struct is_traced<T, decltype(std::declval<T&>().trace(std::declval<tracer&>()))>
+			: std::true_type { };
+
+		//	One record covers an array of count objects, all traced by trace_n
+		//
+		struct traced {
+			byte*		p;
+			std::size_t count;
+			void(*trace_n)(byte*, std::size_t, tracer&);
+		};
+
+		template<class T>
+		static void trace_n(byte* p, std::size_t n, tracer& t) {
+			for (auto o = reinterpret_cast<T*>(p), end = o + n; o != end; ++o) {
+				o->trace(t);
+			}
+		}
+
+		template<class T>
+		static auto tracer_of(std::true_type) -> decltype(traced::trace_n) {
+			return &trace_n<T>;
+		}
+
+		template<class T>
+		static auto tracer_of(std::false_type) -> decltype(traced::trace_n) {
+			return nullptr;
+		}
+
+		struct thpage {
+			gpage				page;
+			bitflags			live_starts;	// for tracing
+			destructors			dtors;			// for objects in this page
+			std::vector<traced>	traced_objects;	// ordered by p
+			std::size_t			committed = 0;	// bytes of the reservation it holds
+
+			//	Construct a page over storage, or over storage of its own if
+			//	storage is null
+			//
+			thpage(std::size_t total_size, std::size_t min_alloc, byte* storage)
+				: page{ total_size, min_alloc, storage }
+				, live_starts{ page.locations(), false }
+			{ }
+
+			//	Return the first traced record for objects at or after p
+			//
+			typename std::vector<traced>::iterator find(const byte* p) noexcept {
+				return std::lower_bound(traced_objects.begin(), traced_objects.end(), p,
+					[](const traced& t, const byte* x) { return std::less<>{}(t.p, x); });
+			}
+		};
+
+		//------------------------------------------------------------------------
+		//	Data: Storage and tracking information
+		//
+		std::unique_ptr<reserved_range>			reservation;	// if any, outlives the pages
+		byte*									reserved_next = nullptr;	// never yet used
+		std::vector<gsl::span<byte>>			reserved_free;	// from dropped pages
+		std::list<thpage>						pages;
+		std::map<const byte*, thpage*>			page_index;	// pages by address
+		std::unordered_set<const root_void*>	roots;
+		std::vector<std::pair<thpage*, int>>	gray;		// marked but not yet traced
+
+		bool is_collecting = false;	// for reentrancy checks
+		bool is_destroying = false;
+
+		template<class T>
+		std::pair<thpage*, byte*> allocate(int n);
+
+		byte* take_reserved(std::size_t bytes);
+		static std::size_t reserved_size(std::size_t bytes) noexcept {
+			return gpage::rounded_size(bytes, reserved_range::granularity());
+		}
+
+		//	Round bytes up to whole OS pages that also hold whole locations of
+		//	min_alloc bytes, so that the gpage uses exactly the committed bytes
+		//
+		static std::size_t reserved_size(std::size_t bytes, std::size_t min_alloc) noexcept {
+			auto a = min_alloc, b = reserved_range::granularity();
+			while (b != 0) {
+				auto r = a % b;
+				a = b;
+				b = r;
+			}
+			return gpage::rounded_size(bytes, min_alloc / a * reserved_range::granularity());
+		}
+
+		template<class T>
+		void remember(thpage& pg, T* p, int n);
+
+		void shade(const void* p);
+		void trace(thpage& pg, gsl::span<byte> range, tracer& t);
+
+	public:
+		//------------------------------------------------------------------------
+		//
+		//	Construct and destroy
+		//
+		tagged_heap() {
+			Expects(current == nullptr && "only one tagged_heap may exist at a time for each tag");
+			current = this;
+
+			static_assert(sizeof(tagged_ptr<int, Tag>) == sizeof(int*)
+				&& std::is_trivially_copyable<tagged_ptr<int, Tag>>::value,
+				"a tagged_ptr must be a trivially copyable raw pointer");
+			static_assert(sizeof(compressed_ptr<int, Tag>) == sizeof(std::uint32_t)
+				&& std::is_trivially_copyable<compressed_ptr<int, Tag>>::value,
+				"a compressed_ptr must be a trivially copyable 32-bit offset");
+		}
+
+		//	Construct a heap whose pages are all in one reservation of
+		//	reserve_bytes of address space (at most 32 GB), so that its objects
+		//	can use compressed_ptrs
+		//
+		explicit tagged_heap(std::size_t reserve_bytes)
+			: tagged_heap()
+		{
+			Expects(reserve_bytes <= (std::size_t{ 1 } << 35)
+				&& "a compressed_ptr can only address a 32 GB reservation");
+			reservation = std::make_unique<reserved_range>(reserved_size(reserve_bytes));
+			compressed_base = reservation->extent().data();
+
+			//	skip the first granule, so that no object has offset 0 (null)
+			reserved_next = compressed_base + reserved_range::granularity();
+		}
+
+		~tagged_heap();
+
+		//------------------------------------------------------------------------
+		//
+		//	make: Allocate one object of type T initialized with args
+		//
+		//	If allocation fails, the returned pointer will be null
+		//
+		template<class T, class ...Args>
+		tagged_ptr<T, Tag> make(Args&&... args) {
+			auto p = allocate<T>(1);
+			if (p.second == nullptr) {
+				return nullptr;
+			}
+			auto t = ::new (static_cast<void*>(p.second)) T{ std::forward<Args>(args)... };
+			remember(*p.first, t, 1);
+			return tagged_ptr<T, Tag>{ t };
+		}
+
+		//------------------------------------------------------------------------
+		//
+		//	make_array: Allocate n default-constructed objects of type T
+		//
+		//	If allocation fails, the returned pointer will be null
+		//
+		template<class T>
+		tagged_ptr<T, Tag> make_array(std::size_t n) {
+			auto p = allocate<T>(gsl::narrow_cast<int>(n));
+			if (p.second == nullptr) {
+				return nullptr;
+			}
+			auto t = reinterpret_cast<T*>(p.second);
+			for (std::size_t i = 0; i < n; ++i) {
+				try {
+					::new (static_cast<void*>(t + i)) T{};
+				} catch(...) {
+					while (i-- > 0) {
+						(t + i)->~T();
+					}
+					throw;
+				}
+			}
+			remember(*p.first, t, gsl::narrow_cast<int>(n));
+			return tagged_ptr<T, Tag>{ t };
+		}
+
+		//------------------------------------------------------------------------
+		//
+		//	collect: Trace from the roots, then reset the tagged_ptrs in the
+		//	unreachable objects, run their destructors, and deallocate them
+		//
+		void collect();
+
+		//	Return the total storage of the heap's pages, in bytes
+		//
+		std::size_t heap_bytes() const;
+	};
+
+	template<class Tag>
+	tagged_heap<Tag>* tagged_heap<Tag>::current = nullptr;
+
+	template<class Tag>
+	byte* tagged_heap<Tag>::compressed_base = nullptr;
+
+
+	//----------------------------------------------------------------------------
+	//
+	//	tagged_heap function implementations
+	//
+	//----------------------------------------------------------------------------
+	//
+	template<class Tag>
+	tagged_heap<Tag>::~tagged_heap()
+	{
+		//	a destructor may not allocate a new object
+		is_destroying = true;
+		current = nullptr;
+		compressed_base = nullptr;
+
+		//	when destroying the arena, null all roots and all tagged_ptrs in the
+		//	heap, and then run all destructors
+		//
+		for (auto& r : roots) {
+			const_cast<root_void*>(r)->p = nullptr;
+		}
+
+		tracer resetter{ *this, true };
+		for (auto& pg : pages) {
+			for (auto& t : pg.traced_objects) {
+				t.trace_n(t.p, t.count, resetter);
+			}
+		}
+
+		for (auto& pg : pages) {
+			pg.dtors.run_all();
+		}
+	}
+
+	template<class Tag>
+	template<class T>
+	std::pair<typename tagged_heap<Tag>::thpage*, byte*> tagged_heap<Tag>::allocate(int n)
+	{
+		Expects(n > 0 && "cannot request an empty allocation");
+		Expects(!is_destroying
+			&& "cannot allocate new objects on a tagged_heap that is being destroyed");
+
+		//	try to allocate in an existing page...
+		for (auto& pg : pages) {
+			auto p = pg.page.template allocate<T>(n);
+			if (p != nullptr) {
+				return{ &pg, p };
+			}
+		}
+
+		//	... allocating another page if necessary, tuned to hold n objects
+		//	of type T as dhpage does; in a reservation, each location is
+		//	aligned for compressed_ptrs and the page fills whole OS pages
+		auto size = std::max<std::size_t>(sizeof(T) * n * 3, 8192 /*good general default*/);
+		auto min_alloc = std::max<std::size_t>(sizeof(T), 4);
+		byte* storage = nullptr;
+		if (reservation) {
+			min_alloc = gpage::rounded_size(min_alloc, std::size_t{ 1 } << compressed_shift);
+			size = reserved_size(size, min_alloc);
+			storage = take_reserved(size);
+		}
+		pages.emplace_back(size, min_alloc, storage);
+		auto& pg = pages.back();
+		if (reservation) {
+			Expects(static_cast<std::size_t>(pg.page.extent().size()) == size
+				&& "a page in a reservation must use exactly the bytes committed for it");
+			pg.committed = size;
+		}
+		page_index.emplace(pg.page.extent().data(), &pg);
+		return{ &pg, pg.page.template allocate<T>(n) };
+	}
+
+	//	Commit bytes (a multiple of the OS page size) of the reservation for a
+	//	new page, reusing a dropped page's addresses if one is big enough
+	//
+	template<class Tag>
+	byte* tagged_heap<Tag>::take_reserved(std::size_t bytes)
+	{
+		byte* p = nullptr;
+		for (auto it = reserved_free.begin(); it != reserved_free.end(); ++it) {
+			if (static_cast<std::size_t>(it->size()) >= bytes) {
+				p = it->data();
+				*it = { it->data() + bytes, it->size() - gsl::narrow_cast<std::ptrdiff_t>(bytes) };
+				if (it->empty()) {
+					reserved_free.erase(it);
+				}
+				break;
+			}
+		}
+
+		if (p == nullptr) {
+			auto ext = reservation->extent();
+			if (bytes > static_cast<std::size_t>(ext.data() + ext.size() - reserved_next)) {
+				throw std::bad_alloc{};
+			}
+			p = reserved_next;
+			reserved_next += bytes;
+		}
+
+		reservation->commit(p, bytes);
+		return p;
+	}
+
+	//	Record the destructor and tracer for n new objects of type T at p
+	//
+	template<class Tag>
+	template<class T>
+	void tagged_heap<Tag>::remember(thpage& pg, T* p, int n)
+	{
+		pg.dtors.store(gsl::span<T>(p, n));
+
+		auto fn = tracer_of<T>(is_traced<T>{});
+		if (fn != nullptr) {
+			auto at = pg.find((const byte*)p);
+			pg.traced_objects.insert(at, { (byte*)p, static_cast<std::size_t>(n), fn });
+		}
+
+		//	objects allocated by destructors during a collection are born marked
+		if (is_collecting) {
+			pg.live_starts.set(gsl::narrow_cast<int>(
+				pg.page.contains_info((const byte*)p).start_location), true);
+		}
+	}
+
+	//	Mark the allocation that p points into as live, and remember to trace
+	//	it if it wasn't already marked
+	//
+	template<class Tag>
+	void tagged_heap<Tag>::shade(const void* p)
+	{
+		if (p == nullptr) {
+			return;
+		}
+
+		// find which page it points into...
+		auto x = static_cast<const byte*>(p);
+		auto it = page_index.upper_bound(x);
+		Expects(it != page_index.begin() && (--it)->second->page.contains(x)
+			&& "a tagged_ptr must point into its tagged_heap");
+		auto& pg = *it->second;
+
+		auto where = pg.page.contains_info(x);
+		Expects(where.found != gpage::in_range_unallocated
+			&& "must not point to unallocated memory");
+
+		// ... and mark the chunk as live
+		auto start = gsl::narrow_cast<int>(where.start_location);
+		if (!pg.live_starts.get(start)) {
+			pg.live_starts.set(start, true);
+			gray.push_back({ &pg, start });
+		}
+	}
+
+	//	Visit the tagged_ptrs in the objects in range with t
+	//
+	template<class Tag>
+	void tagged_heap<Tag>::trace(thpage& pg, gsl::span<byte> range, tracer& t)
+	{
+		auto last = pg.find(range.data() + range.size());
+		for (auto it = pg.find(range.data()); it != last; ++it) {
+			it->trace_n(it->p, it->count, t);
+		}
+	}
+
+	template<class Tag>
+	void tagged_heap<Tag>::collect()
+	{
+		Expects(!is_collecting && "collection cannot be started from a deferred destructor");
+		is_collecting = true;
+		struct end_collecting {
+			bool& flag;
+			~end_collecting() { flag = false; }
+		} guard{ is_collecting };
+
+		//	1. mark from the roots, tracing each marked allocation for the
+		//	allocations it keeps alive
+		//
+		for (auto& pg : pages) {
+			pg.live_starts.set_all(false);
+		}
+		for (auto& r : roots) {
+			shade(r->p);
+		}
+
+		tracer marker{ *this, false };
+		while (!gray.empty()) {
+			auto g = gray.back();
+			gray.pop_back();
+			trace(*g.first, g.first->page.allocation_extent(g.second), marker);
+		}
+
+		//	2. sweep each page: reset the tagged_ptrs in its unreachable objects,
+		//	then run their destructors, and then deallocate them
+		//
+		tracer resetter{ *this, true };
+		for (auto& pg : pages) {
+			std::vector<gsl::span<byte>> dead;
+			for (auto where = 0; where < pg.page.locations(); ++where) {
+				if (pg.page.location_info(where).is_start && !pg.live_starts.get(where)) {
+					dead.push_back(pg.page.allocation_extent(where));
+				}
+			}
+			if (dead.empty()) {
+				continue;
+			}
+
+			{
+				destructors::batch batch;
+				for (auto& extent : dead) {
+					trace(pg, extent, resetter);
+					pg.dtors.take(extent, batch);
+					pg.traced_objects.erase(pg.find(extent.data()),
+											pg.find(extent.data() + extent.size()));
+				}
+				batch.run();
+			}
+
+			for (auto& extent : dead) {
+				pg.page.deallocate(extent.data());
+			}
+		}
+
+		//	3. finally, drop all now-unused pages
+		//
+		for (auto pg = pages.begin(); pg != pages.end(); ) {
+			if (pg->page.is_empty()) {
+				auto extent = pg->page.extent();
+				auto committed = pg->committed;
+				page_index.erase(extent.data());
+				pg = pages.erase(pg);
+				if (committed > 0) {
+					reservation->decommit(extent.data(), committed);
+					reserved_free.push_back({ extent.data(), gsl::narrow_cast<std::ptrdiff_t>(committed) });
+				}
+			}
+			else {
+				++pg;
+			}
+		}
+	}
+
+	template<class Tag>
+	std::size_t tagged_heap<Tag>::heap_bytes() const
+	{
+		std::size_t total = 0;
+		for (auto& pg : pages) {
+			total += pg.page.extent().size();
+		}
+		return total;
+	}
+
+}
+
+#endif
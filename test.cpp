@@ -23,6 +23,7 @@
 //----------------------------------------------------------------------------
 
 #include "deferred_allocator.h"
+#include "tagged_heap.h"
 using namespace gcpp;
 
 #include <iostream>
@@ -30,8 +31,17 @@ using namespace gcpp;
 #include <set>
 #include <array>
 #include <chrono>
+#include <algorithm>
+#include <string>
 using namespace std;
 
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
 
 struct widget {
 	long v;
@@ -397,63 +407,2757 @@ void test_deferred_array() {
 }
 
 
-void test_bitflags() {
-	const int N = 100;	// picked so that we have 3 x 32-bit units + 1 partial unit,
-						// so we can exercise the boundary and internal unit cases
+//----------------------------------------------------------------------------
+//
+//	Incremental collection with collect_step, with the program changing
+//	pointers in between steps.
+//
+//----------------------------------------------------------------------------
 
-	//	Test that we can correctly set any bit range [i,j)
-	for (auto i = 0; i < N; ++i) {
-		for (auto j = i; j < N; ++j) {
-			bitflags flags(100, false);
-			flags.set(i, j, true);
-			for (auto test = 0; test < N; ++test) {
-				assert(flags.get(test) == (i <= test && test < j));
+struct counted_node {
+	static int count;
+
+	long v;
+	deferred_ptr<counted_node> next;
+	deferred_ptr<counted_node> other;
+
+	counted_node(long value = 0) : v{ value } { ++count; }
+	~counted_node() { --count; }
+};
+
+int counted_node::count = 0;
+
+void test_collect_step() {
+	deferred_heap heap;
+	{
+		//	a reachable chain of 100 nodes...
+		auto head = heap.make<counted_node>(0);
+		auto last = head.get();
+		for (auto i = 1; i < 100; ++i) {
+			last->next = heap.make<counted_node>(i);
+			last = last->next.get();
+		}
+
+		//	... and 100 unreachable two-node cycles
+		for (auto i = 0; i < 100; ++i) {
+			auto a = heap.make<counted_node>(-1);
+			a->next = heap.make<counted_node>(-1);
+			a->next->next = a;
+		}
+		assert(counted_node::count == 300);
+
+		auto steps = 0;
+		while (!heap.collect_step(collect_budget::of_objects(4))) {
+			if (++steps == 1) {
+				//	the head has been scanned by now; move the back half of the
+				//	chain to hang off the head, so that only the write barrier on
+				//	the old link keeps it alive in this cycle
+				auto mid = head.get();
+				for (auto i = 0; i < 50; ++i) {
+					mid = mid->next.get();
+				}
+				head->other = mid->next;
+				mid->next = nullptr;
+
+				//	and allocate a new node during marking
+				head->next->other = heap.make<counted_node>(1000);
 			}
 		}
+		assert(steps > 1);
+		assert(counted_node::count == 101);
+
+		auto i = 0;
+		for (auto p = head.get(); p != nullptr; p = p->next.get()) {
+			assert(p->v == i++);
+		}
+		assert(i == 51);
+		for (auto p = head->other.get(); p != nullptr; p = p->next.get()) {
+			assert(p->v == i++);
+		}
+		assert(i == 100);
+		assert(head->next->other->v == 1000);
+
+		//	with nothing to collect, a whole cycle by time budget frees nothing
+		while (!heap.collect_step(collect_budget::of_time(std::chrono::microseconds(100)))) {
+		}
+		assert(counted_node::count == 101);
 	}
 
-	//	Test that we can find a true bit set anywhere with any range
-	for (auto set = 0; set < N; ++set) {
-		bitflags flags(100, false);
-		flags.set(set, true);
-		for (auto i = 0; i <= set; ++i) {
-			for (auto j = i; j < N; ++j) {
-				assert(flags.find_next(i, j, true) == min(j,set));
+	heap.collect();
+	assert(counted_node::count == 0);
+}
+
+void time_collect_step() {
+	const int N = 5000;
+
+	deferred_heap heap;
+	vector<deferred_ptr<counted_node>> v;
+	auto make_garbage = [&] {
+		for (auto i = 0; i < N; ++i) {
+			v.push_back(heap.make<counted_node>(i));
+			auto a = heap.make<counted_node>(-1);
+			a->next = heap.make<counted_node>(-1);
+			a->next->next = a;
+		}
+	};
+
+	make_garbage();
+	auto start = std::chrono::high_resolution_clock::now();
+	heap.collect();
+	auto end = std::chrono::high_resolution_clock::now();
+	cout << "collect() (" << N << " live, " << 2*N << " garbage) pause: "
+		<< std::chrono::duration<double, std::milli>(end - start).count()
+		<< "ms\n";
+
+	make_garbage();
+	auto steps = 0;
+	auto longest = 0.0;
+	for (auto done = false; !done; ++steps) {
+		start = std::chrono::high_resolution_clock::now();
+		done = heap.collect_step(collect_budget::of_time(std::chrono::milliseconds(1)));
+		end = std::chrono::high_resolution_clock::now();
+		longest = std::max(longest, std::chrono::duration<double, std::milli>(end - start).count());
+	}
+	cout << "collect_step(1ms) (" << 2*N << " live, " << 2*N << " garbage): "
+		<< steps << " steps, longest pause " << longest << "ms\n";
+}
+
+
+//----------------------------------------------------------------------------
+//
+//	Background collection, with the program changing pointers while the
+//	collector thread marks.
+//
+//----------------------------------------------------------------------------
+
+void test_background_collector() {
+	deferred_heap heap;
+	heap.set_background_collector(true);
+	{
+		auto head = heap.make<counted_node>(0);
+		for (auto round = 0; round < 20; ++round) {
+			//	a reachable chain of 100 nodes and 100 unreachable cycles
+			auto last = head.get();
+			for (auto i = 1; i < 100; ++i) {
+				last->next = heap.make<counted_node>(i);
+				last = last->next.get();
 			}
+			head->other = nullptr;
+			for (auto i = 0; i < 100; ++i) {
+				auto a = heap.make<counted_node>(-1);
+				a->next = heap.make<counted_node>(-1);
+				a->next->next = a;
+			}
+
+			//	start a cycle, and then while it runs move the back half of
+			//	the chain to hang off the head
+			heap.collect();
+			auto mid = head.get();
+			for (auto i = 0; i < 50; ++i) {
+				mid = mid->next.get();
+			}
+			head->other = mid->next;
+			mid->next = nullptr;
+			heap.finish_collection();
+
+			auto i = 0;
+			for (auto p = head.get(); p != nullptr; p = p->next.get()) {
+				assert(p->v == i++);
+			}
+			for (auto p = head->other.get(); p != nullptr; p = p->next.get()) {
+				assert(p->v == i++);
+			}
+			assert(i == 100);
 		}
+
+		//	a cycle started now frees everything but the last chain
+		heap.collect();
+		heap.finish_collection();
+		assert(counted_node::count == 100);
 	}
 
-	//	Test that we can find a false bit set anywhere with any range
-	for (auto set = 0; set < N; ++set) {
-		bitflags flags(100, true);
-		flags.set(set, false);
-		for (auto i = 0; i <= set; ++i) {
-			for (auto j = i; j < N; ++j) {
-				assert(flags.find_next(i, j, false) == min(j, set));
+	heap.collect();
+	heap.finish_collection();
+	assert(counted_node::count == 0);
+	heap.set_background_collector(false);
+}
+
+//	Mutator operation latency while collecting every 1000 operations, with
+//	stop-the-world collect() and with the background collector
+//
+void time_background_collector() {
+	const int N = 20000, Live = 2000;
+
+	for (auto background : { false, true }) {
+		deferred_heap heap;
+		heap.set_background_collector(background);
+
+		vector<deferred_ptr<counted_node>> slots(Live);
+		vector<double> latencies;
+		latencies.reserve(N);
+
+		for (auto i = 0; i < N; ++i) {
+			auto start = std::chrono::high_resolution_clock::now();
+			if (i % 1000 == 999) {
+				heap.collect();
 			}
+			auto& slot = slots[i % Live];
+			slot = heap.make<counted_node>(i);
+			slot->next = slots[(i + 1) % Live];
+			auto end = std::chrono::high_resolution_clock::now();
+			latencies.push_back(std::chrono::duration<double, std::micro>(end - start).count());
 		}
+		heap.finish_collection();
+
+		sort(latencies.begin(), latencies.end());
+		cout << (background ? "background collector" : "stop-the-world collect()")
+			<< " (" << N << " ops) latency: p50 " << latencies[N / 2]
+			<< "us, p99 " << latencies[N * 99 / 100]
+			<< "us, p99.9 " << latencies[N * 999 / 1000]
+			<< "us, max " << latencies.back() << "us\n";
 	}
+}
 
-	//flags.debug_print();
+
+//	Generational collection: a minor cycle frees young garbage, keeps young
+//	objects reachable only from old ones, and leaves old garbage for a major cycle
+//
+void test_generational() {
+	deferred_heap heap;
+	heap.set_generational(true);
+	{
+		//	a chain of 100 nodes, which the first minor cycle promotes
+		auto head = heap.make<counted_node>(0);
+		auto last = head.get();
+		for (auto i = 1; i < 100; ++i) {
+			last->next = heap.make<counted_node>(i);
+			last = last->next.get();
+		}
+		heap.collect_minor();
+		assert(counted_node::count == 100);
+
+		for (auto round = 0; round < 10; ++round) {
+			//	young garbage cycles
+			for (auto i = 0; i < 100; ++i) {
+				auto a = heap.make<counted_node>(-1);
+				a->next = heap.make<counted_node>(-1);
+				a->next->next = a;
+			}
+
+			//	young objects reachable only from old ones; the previous
+			//	round's are now old garbage
+			head->other = heap.make<counted_node>(round);
+			last->other = heap.make<counted_node>(round);
+
+			heap.collect_minor();
+			assert(counted_node::count == 102 + 2 * round);
+			assert(head->other->v == round && last->other->v == round);
+		}
+
+		heap.collect_major();
+		assert(counted_node::count == 102);
+
+		//	after a major cycle, old-to-young pointers are still remembered
+		last->other = heap.make<counted_node>(42);
+		heap.make<counted_node>(-1);
+		heap.collect_minor();
+		assert(counted_node::count == 102);
+		assert(last->other->v == 42);
+
+		auto i = 0;
+		for (auto p = head.get(); p != nullptr; p = p->next.get()) {
+			assert(p->v == i++);
+		}
+		assert(i == 100);
+	}
+
+	heap.collect();
+	assert(counted_node::count == 0);
 }
 
+//	Collection time with a high allocation rate, a small live set of young
+//	objects, and a larger old structure, with collect() and collect_minor()
+//
+void time_generational() {
+	const int Old = 5000, Rounds = 50, Young = 1000;
+
+	for (auto generational : { false, true }) {
+		deferred_heap heap;
+		heap.set_generational(generational);
+
+		auto head = heap.make<counted_node>(0);
+		auto last = head.get();
+		for (auto i = 1; i < Old; ++i) {
+			last->next = heap.make<counted_node>(i);
+			last = last->next.get();
+		}
+		heap.collect();
 
-int main() {
-	//test_page();
-	//test_bitflags();
+		auto total = std::chrono::high_resolution_clock::duration{};
+		for (auto round = 0; round < Rounds; ++round) {
+			for (auto i = 0; i < Young; ++i) {
+				auto p = heap.make<counted_node>(i);
+				if (i % 100 == 0) {
+					p->next = head->other;
+					head->other = p;
+				}
+			}
 
-	//test_deferred_heap();
-	//time_deferred_heap();
+			auto start = std::chrono::high_resolution_clock::now();
+			if (generational) {
+				heap.collect_minor();
+			}
+			else {
+				heap.collect();
+			}
+			total += std::chrono::high_resolution_clock::now() - start;
+		}
 
-	//test_deferred_allocator();
+		cout << (generational ? "collect_minor()" : "collect()")
+			<< " (" << Old << " old, " << Rounds << " x " << Young << " young): "
+			<< std::chrono::duration<double, std::milli>(total).count() / Rounds
+			<< "ms per collection\n";
+	}
+}
 
-	//test_deferred_allocator_set();
-	//time_deferred_allocator_set();
 
-	test_deferred_allocator_vector();
-	//time_deferred_allocator_vector();
+//	Region-selective collection: collecting the pages with the most garbage
+//	frees only garbage, including objects reachable only from other pages
+//
+void test_collect_regions() {
+	deferred_heap heap;
+	{
+		//	a chain of 300 nodes, which collect() finds to be all live
+		auto head = heap.make<counted_node>(0);
+		auto last = head.get();
+		for (auto i = 1; i < 300; ++i) {
+			last->next = heap.make<counted_node>(i);
+			last = last->next.get();
+		}
+		heap.collect();
+		assert(counted_node::count == 300);
+
+		//	garbage cycles, among them nodes reachable only from the chain
+		//	that were stored before the remembered sets were kept...
+		auto keep = head.get();
+		for (auto i = 0; i < 200; ++i) {
+			auto a = heap.make<counted_node>(-1);
+			a->next = heap.make<counted_node>(-1);
+			a->next->next = a;
+			if (i % 20 == 0) {
+				keep->other = heap.make<counted_node>(2000 + i);
+				keep = keep->next.get();
+			}
+		}
+		heap.set_region_collection(true);
 
-	//test_deferred_array();
+		//	... and a new node reachable only from the chain
+		last->other = heap.make<counted_node>(1000);
+		assert(counted_node::count == 711);
+
+		auto check_kept = [&] {
+			auto i = 0;
+			for (auto p = head.get(); p != keep; p = p->next.get(), i += 20) {
+				assert(p->other->v == 2000 + i);
+			}
+			assert(last->other->v == 1000);
+		};
+
+		//	collecting the page with the most garbage frees only garbage
+		heap.collect_regions(1);
+		assert(311 <= counted_node::count && counted_node::count < 711);
+		check_kept();
+
+		//	collecting every page is the same as collect()
+		heap.collect_regions(100);
+		assert(counted_node::count == 311);
+		check_kept();
+
+		auto i = 0;
+		for (auto p = head.get(); p != nullptr; p = p->next.get()) {
+			assert(p->v == i++);
+		}
+		assert(i == 300);
+	}
+
+	heap.collect();
+	assert(counted_node::count == 0);
+}
+
+//	Pause time of collect() and collect_regions() with a large live structure
+//	and a little new garbage between collections
+//
+void time_collect_regions() {
+	const int Live = 20000, Rounds = 20, Garbage = 1000;
+
+	for (auto regions : { false, true }) {
+		deferred_heap heap;
+		heap.set_region_collection(regions);
+
+		auto head = heap.make<counted_node>(0);
+		auto last = head.get();
+		for (auto i = 1; i < Live; ++i) {
+			last->next = heap.make<counted_node>(i);
+			last = last->next.get();
+		}
+		heap.collect();
+
+		auto total = std::chrono::high_resolution_clock::duration{};
+		for (auto round = 0; round < Rounds; ++round) {
+			for (auto i = 0; i < Garbage; ++i) {
+				heap.make<counted_node>(i);
+			}
+
+			auto start = std::chrono::high_resolution_clock::now();
+			if (regions) {
+				heap.collect_regions(8);
+			}
+			else {
+				heap.collect();
+			}
+			total += std::chrono::high_resolution_clock::now() - start;
+		}
+
+		cout << (regions ? "collect_regions(8)" : "collect()")
+			<< " (" << Live << " live, " << Rounds << " x " << Garbage << " garbage): "
+			<< std::chrono::duration<double, std::milli>(total).count() / Rounds
+			<< "ms per collection, " << counted_node::count - Live << " garbage left\n";
+	}
+}
+
+//	Time to assign deferred_ptrs in the heap, without and with the remembered
+//	sets that region collection (and generational) mode keeps
+//
+void time_remembered_sets() {
+	const int N = 10000, Rounds = 100;
+
+	for (auto regions : { false, true }) {
+		deferred_heap heap;
+		heap.set_region_collection(regions);
+
+		std::vector<deferred_ptr<counted_node>> nodes;
+		for (auto i = 0; i < N; ++i) {
+			nodes.push_back(heap.make<counted_node>(i));
+		}
+
+		auto start = std::chrono::high_resolution_clock::now();
+		for (auto round = 1; round <= Rounds; ++round) {
+			for (auto i = 0; i < N; ++i) {
+				nodes[i]->other = nodes[(i + round * 997) % N];	// mostly on other pages
+			}
+		}
+		auto end = std::chrono::high_resolution_clock::now();
+
+		for (auto& n : nodes) {
+			n->other = nullptr;
+		}
+		cout << (regions ? "with" : "without") << " remembered sets: "
+			<< std::chrono::duration<double, std::nano>(end - start).count() / (N * Rounds)
+			<< "ns per assignment\n";
+	}
+}
+
+
+//	Lazy sweeping: collect() destroys nothing, and unreachable objects are
+//	destroyed as allocation needs their pages' space, or by finish_sweep()
+//
+void test_lazy_sweep() {
+	deferred_heap heap;
+	heap.set_lazy_sweep(true);
+	{
+		auto head = heap.make<counted_node>(0);
+		auto last = head.get();
+		for (auto i = 1; i < 100; ++i) {
+			last->next = heap.make<counted_node>(i);
+			last = last->next.get();
+		}
+		for (auto i = 0; i < 100; ++i) {
+			auto a = heap.make<counted_node>(-1);
+			a->next = heap.make<counted_node>(-1);
+			a->next->next = a;
+		}
+
+		heap.collect();
+		assert(counted_node::count == 300);
+
+		//	allocating sweeps the first page, which has room again
+		last->other = heap.make<counted_node>(1000);
+		assert(counted_node::count < 300);
+
+		heap.finish_sweep();
+		assert(counted_node::count == 101);
+		assert(last->other->v == 1000);
+
+		auto i = 0;
+		for (auto p = head.get(); p != nullptr; p = p->next.get()) {
+			assert(p->v == i++);
+		}
+		assert(i == 100);
+	}
+
+	heap.collect();
+	heap.finish_sweep();
+	assert(counted_node::count == 0);
+}
+
+//	Pause time of collect() with eager and with lazy sweeping, and the total
+//	time including the allocations that then do the sweeping
+//
+void time_lazy_sweep() {
+	const int Live = 2000, Rounds = 20, Garbage = 5000;
+
+	for (auto lazy : { false, true }) {
+		deferred_heap heap;
+		heap.set_lazy_sweep(lazy);
+
+		vector<deferred_ptr<counted_node>> live(Live);
+		for (auto& p : live) {
+			p = heap.make<counted_node>(0);
+		}
+
+		auto pause = std::chrono::high_resolution_clock::duration{};
+		auto start_all = std::chrono::high_resolution_clock::now();
+		for (auto round = 0; round < Rounds; ++round) {
+			for (auto i = 0; i < Garbage; ++i) {
+				heap.make<counted_node>(i);
+			}
+
+			auto start = std::chrono::high_resolution_clock::now();
+			heap.collect();
+			pause += std::chrono::high_resolution_clock::now() - start;
+		}
+		heap.finish_sweep();
+		auto total = std::chrono::high_resolution_clock::now() - start_all;
+
+		cout << (lazy ? "lazy" : "eager") << " sweeping (" << Rounds << " x "
+			<< Garbage << " garbage): " << std::chrono::duration<double, std::milli>(pause).count() / Rounds
+			<< "ms per collect(), " << std::chrono::duration<double, std::milli>(total).count()
+			<< "ms total\n";
+	}
+}
+
+
+//	A counted node that compact() may move
+//
+struct relocatable_node {
+	static int count;
+
+	long v;
+	deferred_ptr<relocatable_node> next;
+
+	relocatable_node(long value = 0) : v{ value } { ++count; }
+	relocatable_node(relocatable_node&& that) : v{ that.v }, next{ that.next } { ++count; }
+	~relocatable_node() { --count; }
+};
+
+int relocatable_node::count = 0;
+
+namespace gcpp {
+	template<>
+	struct is_relocatable<relocatable_node> : std::true_type { };
+}
+
+//	Compaction moves relocatable objects out of sparse pages, following them
+//	with every root and in-heap deferred_ptr, and leaves other objects alone
+//
+void test_compact() {
+	deferred_heap heap;
+	{
+		//	keep every 10th of 2000 nodes, chained together, plus one pinned node
+		vector<deferred_ptr<relocatable_node>> nodes;
+		for (auto i = 0; i < 2000; ++i) {
+			nodes.push_back(heap.make<relocatable_node>(i));
+		}
+		auto pinned = heap.make<counted_node>(42);
+		for (auto i = 0; i < 2000; ++i) {
+			if (i % 10 != 0) {
+				nodes[i] = nullptr;
+			}
+			else if (i > 0) {
+				nodes[i - 10]->next = nodes[i];
+			}
+		}
+		auto pinned_address = pinned.get();
+
+		heap.collect();
+		assert(relocatable_node::count == 200);
+		auto before = heap.fragmentation();
+
+		heap.compact();
+		assert(heap.fragmentation() < before);
+		assert(relocatable_node::count == 200);
+		assert(pinned.get() == pinned_address && pinned->v == 42);
+
+		//	every root and every chain link follows the moved nodes
+		for (auto i = 0; i < 2000; i += 10) {
+			assert(nodes[i]->v == i);
+			if (i > 0) {
+				assert(nodes[i - 10]->next == nodes[i]);
+			}
+		}
+	}
+
+	//	a deferred_vector's buffer can move too, and its pointer's bounds
+	//	still check correctly afterwards
+	{
+		vector<std::unique_ptr<deferred_vector<deferred_ptr<long>>>> vectors;
+		for (auto i = 0; i < 2000; ++i) {
+			vectors.push_back(std::make_unique<deferred_vector<deferred_ptr<long>>>(heap));
+			vectors.back()->push_back(heap.make<long>(i));
+		}
+		vector<deferred_ptr<long>*> before;
+		for (auto i = 0; i < 2000; ++i) {
+			if (i % 10 != 0) {
+				vectors[i] = nullptr;
+			}
+			else {
+				before.push_back(vectors[i]->data());
+			}
+		}
+
+		heap.collect();
+		heap.compact();
+
+		auto moved = 0;
+		for (auto i = 0; i < 2000; i += 10) {
+			auto& v = *vectors[i];
+			if (v.data() != before[i / 10]) {
+				++moved;
+			}
+			assert(*v[0] == i);
+			v.push_back(heap.make<long>(i + 1));
+			auto sum = 0L;
+			for (auto& p : v) {
+				sum += *p;
+			}
+			assert(v.size() == 2 && sum == 2 * i + 1);
+		}
+		assert(moved > 0);
+	}
+
+	heap.collect();
+	assert(relocatable_node::count == 0);
+}
+
+//	Fragmentation before and after compact() when most objects die, and how
+//	long compaction takes
+//
+void time_compact() {
+	const int N = 20000, Keep = 20;
+
+	deferred_heap heap;
+	vector<deferred_ptr<relocatable_node>> nodes;
+	for (auto i = 0; i < N; ++i) {
+		nodes.push_back(heap.make<relocatable_node>(i));
+	}
+	for (auto i = 0; i < N; ++i) {
+		if (i % Keep != 0) {
+			nodes[i] = nullptr;
+		}
+	}
+	heap.collect();
+
+	auto before = heap.fragmentation();
+	auto start = std::chrono::high_resolution_clock::now();
+	heap.compact();
+	auto end = std::chrono::high_resolution_clock::now();
+
+	cout << "compact() (" << N / Keep << " of " << N << " nodes live): fragmentation "
+		<< before << " -> " << heap.fragmentation() << ", "
+		<< std::chrono::duration<double, std::milli>(end - start).count() << "ms\n";
+}
+
+
+//	The pacer collects by itself once the heap grows past its goal, either
+//	all at once or in bounded steps spread across allocations
+//
+void test_pacer() {
+	for (auto max_pause : { 0, 100 }) {
+		deferred_heap_options opts;
+		opts.growth_target	= 1;
+		opts.min_heap_bytes = 16 * 1024;
+		opts.max_pause		= std::chrono::microseconds(max_pause);
+
+		deferred_heap heap(opts);
+		{
+			vector<deferred_ptr<counted_node>> live(100);
+			std::size_t peak = 0;
+			for (auto i = 0; i < 20000; ++i) {
+				live[i % live.size()] = heap.make<counted_node>(i);
+				peak = std::max(peak, heap.heap_bytes());
+			}
+
+			//	without the pacer, all 20000 nodes would still be here
+			assert(counted_node::count < 5000);
+			assert(peak < 20000 * sizeof(counted_node));
+			for (auto i = 0u; i < live.size(); ++i) {
+				assert(live[i]->v % live.size() == i);
+			}
+		}
+		heap.collect();
+		heap.finish_collection();
+		assert(counted_node::count == 0);
+	}
+}
+
+//	Throughput and peak heap size for a garbage-heavy workload across pacer
+//	settings (peak is the heap's page storage, sampled every 1000 operations)
+//
+void time_pacer() {
+	const int N = 100000, Live = 1000;
+
+	for (auto growth_target : { 0.0, 0.5, 1.0, 2.0, 4.0 }) {
+		deferred_heap_options opts;
+		opts.growth_target = growth_target;
+		opts.min_heap_bytes = 64 * 1024;
+		opts.collect_before_expand = growth_target == 0;	// the old policy, for comparison
+
+		deferred_heap heap(opts);
+		vector<deferred_ptr<counted_node>> live(Live);
+		std::size_t peak = 0;
+
+		auto start = std::chrono::high_resolution_clock::now();
+		for (auto i = 0; i < N; ++i) {
+			live[i % Live] = heap.make<counted_node>(i);
+			if (i % 1000 == 0) {
+				peak = std::max(peak, heap.heap_bytes());
+			}
+		}
+		auto end = std::chrono::high_resolution_clock::now();
+
+		if (growth_target == 0) {
+			cout << "collect_before_expand: ";
+		}
+		else {
+			cout << "growth_target " << growth_target << ": ";
+		}
+		cout << N / std::chrono::duration<double>(end - start).count() << " allocations/s, peak "
+			<< peak / 1024 << "KB\n";
+	}
+}
+
+
+//	Emptied pages are released, except for the configured amount retained
+//	for reuse
+//
+void test_page_retention() {
+	for (auto retained : { std::size_t{ 0 }, std::size_t{ 1024 * 1024 } }) {
+		deferred_heap_options opts;
+		opts.retained_empty_bytes = retained;
+		deferred_heap heap(opts);
+
+		for (auto i = 0; i < 1000; ++i) {
+			heap.make<counted_node>(i);
+		}
+		auto bytes = heap.heap_bytes();
+		assert(bytes > 0);
+
+		heap.collect();
+		assert(counted_node::count == 0);
+		assert(heap.heap_bytes() == (retained > 0 ? bytes : 0));
+
+		//	the retained pages are reused
+		for (auto i = 0; i < 1000; ++i) {
+			heap.make<counted_node>(i);
+		}
+		assert(retained == 0 || heap.heap_bytes() == bytes);
+		heap.collect();
+	}
+}
+
+//	Bursts of short-lived allocations with a collection after each, with and
+//	without retaining the emptied pages
+//
+void time_page_retention() {
+	const int Bursts = 20000, N = 50;
+
+	for (auto retained : { std::size_t{ 0 }, std::size_t{ 1024 * 1024 } }) {
+		deferred_heap_options opts;
+		opts.retained_empty_bytes = retained;
+		deferred_heap heap(opts);
+
+		auto start = std::chrono::high_resolution_clock::now();
+		for (auto burst = 0; burst < Bursts; ++burst) {
+			for (auto i = 0; i < N; ++i) {
+				heap.make<long>(i);
+			}
+			heap.collect();
+		}
+		auto end = std::chrono::high_resolution_clock::now();
+
+		cout << "retained_empty_bytes " << retained << " (" << Bursts << " bursts of " << N
+			<< "): " << std::chrono::duration<double, std::micro>(end - start).count() / Bursts
+			<< "us per burst\n";
+	}
+}
+
+
+//	Arrays and runs of adjacent objects of the same type take one destructor
+//	record, which is split when part of it is reconstructed
+//
+void test_array_destructors() {
+	deferred_heap heap;
+	{
+		auto a = heap.make_array<counted_node>(1000);
+		assert(counted_node::count == 1000);
+		assert(heap.destructor_count() == 1000);
+		assert(heap.destructor_bytes() < 1000 * sizeof(void*));
+
+		//	elements constructed one at a time are merged too...
+		auto v = deferred_vector<counted_node>(heap);
+		v.reserve(100);
+		for (auto i = 0; i < 100; ++i) {
+			v.emplace_back(i);
+		}
+		assert(counted_node::count == 1100);
+		assert(heap.destructor_count() == 1100);
+
+		//	... and reusing a slot destroys just the object that was there
+		v.pop_back();
+		v.pop_back();
+		v.emplace_back(1000);
+		assert(counted_node::count == 1100);
+		assert(heap.destructor_count() == 1100);
+		assert(v.back().v == 1000 && v[97].v == 97);
+	}
+
+	heap.collect();
+	assert(counted_node::count == 0);
+	assert(heap.destructor_count() == 0);
+}
+
+//	Destructor registry memory and destruction time for a large array
+//
+void time_array_destructors() {
+	const int N = 1000000;
+
+	deferred_heap heap;
+	{
+		auto a = heap.make_array<std::string>(N);
+		cout << "make_array<string>(" << N << "): registry " << heap.destructor_bytes()
+			<< " bytes for " << heap.destructor_count() << " objects";
+	}
+
+	auto start = std::chrono::high_resolution_clock::now();
+	heap.collect();
+	auto end = std::chrono::high_resolution_clock::now();
+	cout << ", destroyed in " << std::chrono::duration<double, std::milli>(end - start).count() << "ms\n";
+}
+
+//	Cost of constructing and of sweeping objects with nontrivial destructors
+//	as the number of them in the heap grows
+//
+void time_destructors() {
+	for (auto N : { 10000, 100000 }) {
+		deferred_heap heap;
+		vector<deferred_ptr<counted_node>> v;
+		v.reserve(N);
+
+		auto start = std::chrono::high_resolution_clock::now();
+		for (auto i = 0; i < N; ++i) {
+			v.push_back(heap.make<counted_node>(i));
+		}
+		auto mid = std::chrono::high_resolution_clock::now();
+		v.clear();
+		heap.collect();
+		auto end = std::chrono::high_resolution_clock::now();
+
+		cout << N << " objects with destructors: "
+			<< std::chrono::duration<double, std::nano>(mid - start).count() / N << "ns per make, "
+			<< std::chrono::duration<double, std::nano>(end - mid).count() / N << "ns per object swept\n";
+	}
+}
+
+void time_sweep_batching() {
+	//	Interleave objects of three types, so that consecutive dead
+	//	allocations have different destructors
+	for (auto N : { 30000, 300000 }) {
+		deferred_heap heap;
+		vector<deferred_ptr<string>> strings;
+		vector<deferred_ptr<vector<int>>> vectors;
+		vector<deferred_ptr<counted_node>> nodes;
+		for (auto i = 0; i < N/3; ++i) {
+			strings.push_back(heap.make<string>("a string too long for the small buffer"));
+			vectors.push_back(heap.make<vector<int>>(8, i));
+			nodes.push_back(heap.make<counted_node>(i));
+		}
+		strings.clear();
+		vectors.clear();
+		nodes.clear();
+
+		auto start = std::chrono::high_resolution_clock::now();
+		heap.collect();
+		auto end = std::chrono::high_resolution_clock::now();
+
+		cout << N << " mixed-type objects: "
+			<< std::chrono::duration<double, std::nano>(end - start).count() / N << "ns per object swept\n";
+	}
+}
+
+
+void test_deferred_finalization() {
+	deferred_heap heap;
+	heap.set_deferred_finalization(true);
+	{
+		auto keep = heap.make<counted_node>(0);
+		for (auto i = 0; i < 100; ++i) {
+			auto a = heap.make<counted_node>(i);
+			a->next = heap.make<counted_node>(i);
+			a->next->next = a;
+		}
+
+		//	collecting only queues the destructors, even over several cycles
+		heap.collect();
+		assert(counted_node::count == 201);
+		heap.collect();
+		assert(counted_node::count == 201);
+
+		assert(!heap.drain_finalizers(collect_budget::of_objects(1)));
+		assert(1 < counted_node::count && counted_node::count < 201);
+		assert(heap.drain_finalizers());
+		assert(counted_node::count == 1);
+		assert(keep->v == 0);
+
+		//	and the storage is then reused
+		auto bytes = heap.heap_bytes();
+		for (auto i = 0; i < 100; ++i) {
+			heap.make<counted_node>(i);
+		}
+		assert(heap.heap_bytes() == bytes);
+	}
+
+	//	the finalizer thread runs the queued destructors
+	heap.set_finalizer_thread(true);
+	assert(heap.get_deferred_finalization());
+	for (auto i = 0; i < 100; ++i) {
+		heap.make<counted_node>(i);
+	}
+	heap.collect();
+	heap.drain_finalizers();
+	assert(counted_node::count == 0);
+	heap.set_finalizer_thread(false);
+
+	//	destroying the heap runs any destructors still queued
+	{
+		deferred_heap heap2;
+		heap2.set_deferred_finalization(true);
+		heap2.make<counted_node>(0);
+		heap2.collect();
+		assert(counted_node::count == 1);
+	}
+	assert(counted_node::count == 0);
+}
+
+//	Pause time of collect() with destructors run inline, queued and drained
+//	afterwards, and queued for the finalizer thread
+//
+void time_deferred_finalization() {
+	const int Live = 2000, Rounds = 20, Garbage = 5000;
+
+	for (auto mode : { 0, 1, 2 }) {
+		deferred_heap heap;
+		heap.set_deferred_finalization(mode == 1);
+		heap.set_finalizer_thread(mode == 2);
+
+		vector<deferred_ptr<vector<int>>> live(Live);
+		for (auto& p : live) {
+			p = heap.make<vector<int>>(64);
+		}
+
+		auto pause = std::chrono::high_resolution_clock::duration{};
+		auto drain = std::chrono::high_resolution_clock::duration{};
+		for (auto round = 0; round < Rounds; ++round) {
+			for (auto i = 0; i < Garbage; ++i) {
+				heap.make<vector<int>>(64);
+			}
+
+			auto start = std::chrono::high_resolution_clock::now();
+			heap.collect();
+			auto mid = std::chrono::high_resolution_clock::now();
+			heap.drain_finalizers();
+			pause += mid - start;
+			drain += std::chrono::high_resolution_clock::now() - mid;
+		}
+
+		const char* names[] = { "inline destructors", "deferred finalization",
+								"finalizer thread" };
+		cout << names[mode] << " (" << Rounds << " x " << Garbage << " garbage): "
+			<< std::chrono::duration<double, std::milli>(pause).count() / Rounds
+			<< "ms per collect(), "
+			<< std::chrono::duration<double, std::milli>(drain).count() / Rounds
+			<< "ms per drain_finalizers()\n";
+	}
+}
+
+
+void test_deferred_ptr_move() {
+	deferred_heap heap;
+	{
+		//	moving leaves the source null, and keeps the target alive
+		auto a = heap.make<counted_node>(1);
+		auto b = std::move(a);
+		assert(!a && b->v == 1);
+		a = std::move(b);
+		assert(a->v == 1 && !b);
+
+		//	between a root and a deferred_ptr in the heap
+		a->next = std::move(b = heap.make<counted_node>(2));
+		assert(!b && a->next->v == 2);
+		auto c = std::move(a->next);
+		assert(!a->next && c->v == 2);
+		swap(a->next, c);
+		assert(a->next->v == 2 && !c);
+
+		//	std::vector and deferred_vector reallocation move their elements
+		{
+			vector<deferred_ptr<counted_node>> roots;
+			auto in_heap = deferred_vector<deferred_ptr<counted_node>>(heap);
+			for (auto i = 0; i < 100; ++i) {
+				roots.push_back(heap.make<counted_node>(i));
+				in_heap.push_back(heap.make<counted_node>(i));
+			}
+			heap.collect();
+			assert(counted_node::count == 202);
+
+			//	sorting moves and swaps
+			std::sort(roots.begin(), roots.end(), [](auto& x, auto& y) { return x->v > y->v; });
+			std::sort(in_heap.begin(), in_heap.end(), [](auto& x, auto& y) { return x->v > y->v; });
+			for (auto i = 0; i < 100; ++i) {
+				assert(roots[i]->v == 99 - i && in_heap[i]->v == 99 - i);
+			}
+			heap.collect();
+			assert(counted_node::count == 202);
+		}
+		heap.collect();
+		assert(counted_node::count == 2);
+	}
+	heap.collect();
+	assert(counted_node::count == 0);
+}
+
+//	Sort a million deferred_ptrs in a std::vector and in a deferred_vector
+//
+void time_deferred_ptr_sort() {
+	const int N = 1000000;
+
+	deferred_heap heap;
+	vector<deferred_ptr<int>> roots;
+	auto in_heap = deferred_vector<deferred_ptr<int>>(heap);
+	roots.reserve(N);
+	in_heap.reserve(N);
+	for (auto i = 0; i < N; ++i) {
+		roots.push_back(heap.make<int>(gsl::narrow_cast<int>((i * 7919LL) % N)));
+		in_heap.push_back(roots.back());
+	}
+
+	auto start = std::chrono::high_resolution_clock::now();
+	std::sort(roots.begin(), roots.end(), [](auto& x, auto& y) { return *x < *y; });
+	auto mid = std::chrono::high_resolution_clock::now();
+	std::sort(in_heap.begin(), in_heap.end(), [](auto& x, auto& y) { return *x < *y; });
+	auto end = std::chrono::high_resolution_clock::now();
+
+	cout << "sort " << N << " deferred_ptrs: "
+		<< std::chrono::duration<double, std::milli>(mid - start).count() << "ms in a vector, "
+		<< std::chrono::duration<double, std::milli>(end - mid).count() << "ms in a deferred_vector\n";
+}
+
+void test_array_deferred_ptr() {
+	deferred_heap heap;
+	{
+		using A = std::allocator_traits<deferred_allocator<int>>;
+		deferred_allocator<int> alloc(heap);
+
+		//	the allocator's pointer knows its allocation's bounds ...
+		auto p = A::allocate(alloc, 10);
+		auto end = p + 10;
+		for (auto q = p; q != end; ++q) {
+			*q = gsl::narrow_cast<int>(q - p);
+		}
+		assert(end - p == 10 && p[9] == 9 && *(end - 1) == 9);
+
+		//	... and keeps them through void_pointer, via a lookup in debug mode,
+		//	and through conversion to const
+		A::void_pointer vp = p + 3;
+		auto q = static_cast<A::pointer>(vp);
+		A::const_pointer cq = q;
+		assert(*q == 3 && q[6] == 9 && q - p == 3 && cq == q && (end - 1) - q == 6 && cq - p == 3);
+
+		//	a plain deferred_ptr converted from it keeps the array alive
+		deferred_ptr<int> dp = p;
+		p = nullptr;
+		end = nullptr;
+		q = nullptr;
+		cq = nullptr;
+		vp = nullptr;
+		heap.collect();
+		assert(dp.get()[9] == 9);
+
+		//	containers iterate with it
+		auto v = deferred_vector<int>(heap);
+		for (auto i = 0; i < 100; ++i) {
+			v.push_back(i);
+		}
+		std::sort(v.begin(), v.end(), std::greater<int>());
+		for (auto i = 0; i < 100; ++i) {
+			assert(v[i] == 99 - i);
+		}
+	}
+	heap.collect();
+}
+
+//	Iterate over an array with deferred_ptr and with array_deferred_ptr;
+//	the difference is in the debug-mode arithmetic checks
+//
+void time_array_deferred_ptr() {
+	const int N = 10000;
+
+	deferred_heap heap;
+	auto arr = heap.make_array<int>(N);
+	auto v = deferred_vector<int>(N, 1, heap);
+
+	auto start = std::chrono::high_resolution_clock::now();
+	auto sum = 0;
+	for (auto i = 0; i < N; ++i) {
+		sum += arr[i];
+	}
+	auto mid = std::chrono::high_resolution_clock::now();
+	for (auto i = 0; i < N; ++i) {
+		sum += v[i];
+	}
+	auto end = std::chrono::high_resolution_clock::now();
+
+	cout << "iterate " << N << " ints (sum " << sum << "): "
+		<< std::chrono::duration<double, std::milli>(mid - start).count() << "ms with deferred_ptr, "
+		<< std::chrono::duration<double, std::milli>(end - mid).count() << "ms with array_deferred_ptr\n";
+}
+
+//	A deferred_root_vector keeps its elements alive as one root range
+//
+void test_deferred_root_vector() {
+	deferred_heap heap;
+	{
+		deferred_root_vector<counted_node> v(heap);
+		for (auto i = 0; i < 100; ++i) {
+			v.push_back(heap.make<counted_node>(i));
+		}
+		v[1]->next = heap.make<counted_node>(-1);
+		heap.collect();
+		assert(counted_node::count == 101 && v.size() == 100 && v[42]->v == 42);
+
+		v.set(0, nullptr);
+		v.pop_back();
+		heap.collect();
+		assert(counted_node::count == 99 && v.size() == 99 && v.at(1)->next->v == -1);
+
+		//	copies and moves keep their elements alive
+		auto w = v;
+		v.clear();
+		heap.collect();
+		assert(counted_node::count == 99 && v.empty() && w[98]->v == 98);
+		auto moved = std::move(w);
+		heap.collect();
+		assert(counted_node::count == 99 && moved.back()->v == 98);
+
+		//	during a cycle, removing an element shades it, so it survives
+		//	through a root made after the cycle began
+		heap.collect_step(collect_budget::of_objects(1));
+		auto p = moved.at(50);
+		moved.clear();
+		heap.finish_collection();
+		assert(p->v == 50);
+		heap.collect();
+		assert(counted_node::count == 1);
+	}
+	heap.collect();
+	assert(counted_node::count == 0);
+
+	//	compaction updates the elements to the objects it moves
+	{
+		deferred_root_vector<relocatable_node> v(heap);
+		for (auto i = 0; i < 2000; ++i) {
+			auto n = heap.make<relocatable_node>(i);
+			if (i % 10 == 0) {
+				v.push_back(n);
+			}
+		}
+		heap.collect();
+		auto before = heap.fragmentation();
+		heap.compact();
+		assert(heap.fragmentation() < before && relocatable_node::count == 200);
+		for (auto i = 0; i < 200; ++i) {
+			assert(v[i]->v == i * 10);
+		}
+	}
+	heap.collect();
+	assert(relocatable_node::count == 0);
+}
+
+//	Build a million roots to a thousand objects, in a vector of
+//	deferred_ptrs and in a deferred_root_vector, and collect with each
+//
+void time_deferred_root_vector() {
+	const int N = 1000000, Objects = 1000;
+
+	deferred_heap heap;
+	vector<deferred_ptr<int>> objects;
+	for (auto i = 0; i < Objects; ++i) {
+		objects.push_back(heap.make<int>(i));
+	}
+
+	auto time = [](auto&& f) {
+		auto start = std::chrono::high_resolution_clock::now();
+		f();
+		return std::chrono::duration<double, std::milli>(
+			std::chrono::high_resolution_clock::now() - start).count();
+	};
+
+	{
+		vector<deferred_ptr<int>> roots;
+		auto build = time([&] {
+			for (auto i = 0; i < N; ++i) {
+				roots.push_back(objects[i % Objects]);
+			}
+		});
+		auto mark = time([&] { heap.collect(); });
+		cout << N << " roots in a vector<deferred_ptr>: build " << build
+			<< "ms, collect " << mark << "ms\n";
+	}
+	{
+		deferred_root_vector<int> roots(heap);
+		auto build = time([&] {
+			for (auto i = 0; i < N; ++i) {
+				roots.push_back(objects[i % Objects]);
+			}
+		});
+		auto mark = time([&] { heap.collect(); });
+		cout << N << " roots in a deferred_root_vector: build " << build
+			<< "ms, collect " << mark << "ms\n";
+	}
+}
+
+//----------------------------------------------------------------------------
+//
+//	Tracing through each page's address-sorted index of its deferred_ptrs,
+//	including after the registry changes between incremental steps.
+//
+//----------------------------------------------------------------------------
+
+void test_pointer_index() {
+	const int N = 100;
+
+	deferred_heap heap;
+	{
+		//	an array of deferred_ptrs keeps alive the nodes that all of its
+		//	elements point to, not just the first
+		auto arr = heap.make_array<deferred_ptr<counted_node>>(N);
+		for (auto i = 0; i < N; ++i) {
+			arr[i] = heap.make<counted_node>(i);
+		}
+		heap.collect();
+		assert(counted_node::count == N);
+
+		//	making nodes and dropping others between steps changes the
+		//	registries of pages that the cycle has already indexed
+		for (auto i = 0; i < N; i += 2) {
+			heap.collect_step(collect_budget::of_objects(1));
+			arr[i]->next = heap.make<counted_node>(N + i);
+			arr[i + 1] = nullptr;
+		}
+		heap.collect();
+		assert(counted_node::count == N);
+		for (auto i = 0; i < N; i += 2) {
+			assert(arr[i]->v == i && arr[i]->next->v == N + i && !arr[i + 1]);
+		}
+	}
+	heap.collect();
+	assert(counted_node::count == 0);
+}
+
+//	Count the hardware cache misses while running f, or return -1 where
+//	the counters are not available
+//
+template<class F>
+long long count_cache_misses(F f) {
+#ifdef __linux__
+	perf_event_attr attr{};
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.size = sizeof(attr);
+	attr.config = PERF_COUNT_HW_CACHE_MISSES;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	auto fd = static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+	if (fd >= 0) {
+		long long count = 0;
+		ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+		ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+		f();
+		ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+		if (read(fd, &count, sizeof(count)) != sizeof(count)) {
+			count = -1;
+		}
+		close(fd);
+		return count;
+	}
+#endif
+	f();
+	return -1;
+}
+
+//	Collection time and cache misses per traced deferred_ptr, for a graph
+//	of nodes with four pointers each to random other nodes
+//
+struct fan_node {
+	deferred_ptr<fan_node> next[4];
+};
+
+void time_pointer_index() {
+	const int N = 200000;
+
+	deferred_heap heap;
+	vector<deferred_ptr<fan_node>> nodes;
+	for (auto i = 0; i < N; ++i) {
+		nodes.push_back(heap.make<fan_node>());
+	}
+	auto r = 1u;
+	for (auto i = 0; i < N; ++i) {
+		for (auto& p : nodes[i]->next) {
+			r = r * 1103515245 + 12345;
+			p = nodes[r % N];
+		}
+	}
+	auto root = nodes[0];
+	nodes.clear();
+
+	for (auto i = 0; i < 2; ++i) {
+		auto start = std::chrono::high_resolution_clock::now();
+		auto misses = count_cache_misses([&] { heap.collect(); });
+		auto end = std::chrono::high_resolution_clock::now();
+		cout << (i == 0 ? "first" : "second") << " collect of " << 4 * N << " deferred_ptrs: "
+			<< std::chrono::duration<double, std::milli>(end - start).count() << "ms, ";
+		if (misses < 0) {
+			cout << "cache misses not available\n";
+		}
+		else {
+			cout << double(misses) / (4 * N) << " cache misses per pointer\n";
+		}
+	}
+}
+
+//	A counted node for use from several threads
+//
+struct shared_node {
+	static std::atomic<int> count;
+
+	long v;
+	deferred_ptr<shared_node> next;
+
+	shared_node(long value = 0) : v{ value } { ++count; }
+	~shared_node() { --count; }
+};
+
+std::atomic<int> shared_node::count{ 0 };
+
+//	An element whose destructor allocates a large array from heap, after
+//	giving another thread time to start a collection
+//
+struct allocating_element {
+	static deferred_heap* heap;
+	static std::atomic<bool> destroying;
+	static std::atomic<int> count;
+
+	int v;
+
+	allocating_element(int value = 0) : v{ value } { ++count; }
+	allocating_element(const allocating_element& that) : v{ that.v } { ++count; }
+	~allocating_element() {
+		destroying = true;
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+		heap->make_array<char>(1 << 20);
+		--count;
+	}
+};
+
+deferred_heap* allocating_element::heap = nullptr;
+std::atomic<bool> allocating_element::destroying{ false };
+std::atomic<int> allocating_element::count{ 0 };
+
+void test_thread_safe_heap() {
+	const int Threads = 4, N = 2000;
+
+	deferred_heap heap;
+	heap.set_thread_safe(true);
+	{
+		//	each thread builds its own list and makes garbage, and they all
+		//	push onto a shared list and collect as they go
+		vector<deferred_ptr<shared_node>> lists(Threads);
+		vector<vector<deferred_ptr<shared_node>>> kept(Threads);
+		deferred_ptr<shared_node> shared;
+		std::mutex shared_mutex;
+
+		vector<std::thread> threads;
+		for (auto t = 0; t < Threads; ++t) {
+			threads.emplace_back([&, t] {
+				for (auto i = 0; i < N; ++i) {
+					auto n = heap.make<shared_node>(i);
+					n->next = lists[t];
+					lists[t] = n;
+					heap.make<shared_node>(-1);
+					if (i % 10 == 0) {
+						kept[t].push_back(n);
+					}
+					if (i % 100 == 0) {
+						std::lock_guard<std::mutex> lock{ shared_mutex };
+						auto s = heap.make<shared_node>(t);
+						s->next = shared;
+						shared = s;
+					}
+					if (i % 500 == 0) {
+						heap.collect();
+					}
+				}
+			});
+		}
+		for (auto& t : threads) {
+			t.join();
+		}
+		heap.collect();
+		assert(shared_node::count == Threads * N + Threads * N / 100);
+
+		for (auto t = 0; t < Threads; ++t) {
+			auto i = N;
+			for (auto p = lists[t]; p; p = p->next) {
+				assert(p->v == --i);
+			}
+			assert(i == 0);
+		}
+
+		//	link the lists into one cycle across all the threads' pages, and
+		//	drop it from yet another thread; it is still reachable from the
+		//	roots the other threads left in kept, until this thread destroys them
+		for (auto t = 0; t < Threads; ++t) {
+			auto tail = lists[t];
+			while (tail->next) {
+				tail = tail->next;
+			}
+			tail->next = lists[(t + 1) % Threads];
+		}
+		std::thread{ [&] {
+			for (auto& l : lists) {
+				l = nullptr;
+			}
+			shared = nullptr;
+		} }.join();
+		heap.collect();
+		assert(shared_node::count == Threads * N);
+
+		kept.clear();
+		heap.collect();
+		assert(shared_node::count == 0);
+	}
+
+	//	a construction that runs a deferred destructor which allocates, while
+	//	another thread collects: the destructor runs holding no heap locks,
+	//	so its allocation can wait for the collection
+	{
+		allocating_element::heap = &heap;
+		std::thread collector{ [&] {
+			while (!allocating_element::destroying) {
+				std::this_thread::yield();
+			}
+			heap.collect();
+		} };
+		{
+			deferred_vector<allocating_element> v(heap);
+			v.emplace_back(1);
+			v.pop_back();
+			v.emplace_back(2);	// runs the first element's destructor
+			assert(v[0].v == 2);
+		}
+		collector.join();
+		heap.collect();
+		assert(allocating_element::count == 0);
+	}
+}
+
+//	Allocation throughput from 1 to 32 threads, each making small objects
+//	that soon become garbage, with the pacer collecting
+//
+void time_thread_safe_heap() {
+	const int N = 200000;	// allocations per thread
+
+	auto run = [&](int threads, bool thread_safe) {
+		deferred_heap_options options;
+		options.growth_target = 1;
+		deferred_heap heap{ options };
+		heap.set_thread_safe(thread_safe);
+
+		auto start = std::chrono::high_resolution_clock::now();
+		vector<std::thread> ts;
+		for (auto t = 0; t < threads; ++t) {
+			ts.emplace_back([&] {
+				for (auto i = 0; i < N; ++i) {
+					heap.make<long>(i);
+				}
+			});
+		}
+		for (auto& t : ts) {
+			t.join();
+		}
+		auto end = std::chrono::high_resolution_clock::now();
+
+		auto ms = std::chrono::duration<double, std::milli>(end - start).count();
+		cout << threads << (thread_safe ? " thread(s), thread-safe: " : " thread, not thread-safe: ")
+			<< ms << "ms, " << N * threads / ms / 1000 << "M allocations/s\n";
+	};
+
+	run(1, false);
+	for (auto threads : { 1, 2, 4, 8, 16, 32 }) {
+		run(threads, true);
+	}
+}
+
+//	A counted node on a tagged_heap, whose tagged_ptrs are found by trace
+//
+struct graph_tag { };
+struct other_graph_tag { };
+
+struct tagged_node {
+	static int count;
+
+	long v;
+	tagged_ptr<tagged_node, graph_tag> next;
+	tagged_ptr<tagged_node, graph_tag> other;
+
+	tagged_node(long value = 0) : v{ value } { ++count; }
+	~tagged_node() {
+		assert(next == nullptr && other == nullptr);
+		--count;
+	}
+
+	template<class Tracer>
+	void trace(Tracer& t) {
+		t(next);
+		t(other);
+	}
+};
+
+int tagged_node::count = 0;
+
+void test_tagged_heap() {
+	static_assert(sizeof(tagged_ptr<tagged_node, graph_tag>) == sizeof(tagged_node*),
+		"a tagged_ptr is the size of a raw pointer");
+	static_assert(std::is_trivially_copyable<tagged_ptr<tagged_node, graph_tag>>::value,
+		"a tagged_ptr is trivially copyable");
+	static_assert(!std::is_assignable<tagged_ptr<tagged_node, graph_tag>&,
+		tagged_ptr<tagged_node, other_graph_tag>>::value,
+		"tagged_ptrs into different heaps cannot be assigned");
+
+	{
+		tagged_heap<graph_tag> heap;
+
+		tagged_root<tagged_node, graph_tag> head = heap.make<tagged_node>(0);
+		auto last = head.get();
+		for (auto i = 1; i < 100; ++i) {
+			last->next = heap.make<tagged_node>(i);
+			last = last->next.get();
+		}
+		for (auto i = 0; i < 100; ++i) {
+			auto a = heap.make<tagged_node>(-1);
+			a->next = heap.make<tagged_node>(-1);
+			a->next->next = a;
+		}
+		assert(tagged_node::count == 300);
+
+		heap.collect();
+		assert(tagged_node::count == 100);
+
+		auto i = 0;
+		for (auto p = head.get(); p != nullptr; p = p->next.get()) {
+			assert(p->v == i++);
+		}
+		assert(i == 100);
+
+		//	copying roots is fine too
+		auto second = head;
+		second = head->next;
+		head->next->next = nullptr;
+		head = nullptr;
+		heap.collect();
+		assert(tagged_node::count == 1);
+		assert(second->v == 1);
+
+		tagged_root<tagged_node, graph_tag> arr = heap.make_array<tagged_node>(10);
+		arr->other = second;
+		heap.collect();
+		assert(tagged_node::count == 11);
+
+		second = nullptr;
+		heap.collect();
+		assert(tagged_node::count == 11);
+
+		arr = nullptr;
+		heap.collect();
+		assert(tagged_node::count == 0);
+		assert(heap.heap_bytes() == 0);
+
+		//	objects still in the heap are destroyed with it, and roots that
+		//	outlive it are nulled
+		head = heap.make<tagged_node>(0);
+		head->next = heap.make<tagged_node>(1);
+		head->next->next = head;
+	}
+	assert(tagged_node::count == 0);
+}
+
+//	Memory and time for a graph of nodes with two pointers each, built and
+//	rewired with deferred_ptrs and with tagged_ptrs
+//
+void time_tagged_heap() {
+	const int N = 10000, Rewires = 100000;
+
+	{
+		deferred_heap heap;
+		vector<deferred_ptr<counted_node>> nodes;
+		auto start = std::chrono::high_resolution_clock::now();
+		for (auto i = 0; i < N; ++i) {
+			nodes.push_back(heap.make<counted_node>(i));
+		}
+		for (auto i = 0; i < Rewires; ++i) {
+			auto p = nodes[(i * 7919) % N];
+			nodes[i % N]->next = p;
+			nodes[(i * 31) % N]->other = p->next;
+		}
+		auto mid = std::chrono::high_resolution_clock::now();
+		heap.collect();
+		auto end = std::chrono::high_resolution_clock::now();
+
+		cout << "deferred_ptr nodes (" << sizeof(counted_node) << " bytes each): "
+			<< std::chrono::duration<double, std::milli>(mid - start).count() << "ms to build and rewire, "
+			<< std::chrono::duration<double, std::milli>(end - mid).count() << "ms to collect\n";
+	}
+
+	{
+		tagged_heap<graph_tag> heap;
+		vector<tagged_root<tagged_node, graph_tag>> nodes;
+		auto start = std::chrono::high_resolution_clock::now();
+		for (auto i = 0; i < N; ++i) {
+			nodes.push_back(heap.make<tagged_node>(i));
+		}
+		for (auto i = 0; i < Rewires; ++i) {
+			tagged_ptr<tagged_node, graph_tag> p = nodes[(i * 7919) % N];
+			nodes[i % N]->next = p;
+			nodes[(i * 31) % N]->other = p->next;
+		}
+		auto mid = std::chrono::high_resolution_clock::now();
+		heap.collect();
+		auto end = std::chrono::high_resolution_clock::now();
+
+		cout << "tagged_ptr nodes   (" << sizeof(tagged_node) << " bytes each): "
+			<< std::chrono::duration<double, std::milli>(mid - start).count() << "ms to build and rewire, "
+			<< std::chrono::duration<double, std::milli>(end - mid).count() << "ms to collect\n";
+	}
+}
+
+
+//----------------------------------------------------------------------------
+//
+//	compressed_ptrs: 32-bit offsets into a tagged_heap's reservation.
+//
+//----------------------------------------------------------------------------
+
+struct compact_tag { };
+
+struct compact_node {
+	static int count;
+
+	int v;
+	compressed_ptr<compact_node, compact_tag> next;
+	compressed_ptr<compact_node, compact_tag> other;
+
+	compact_node(int value = 0) : v{ value } { ++count; }
+	~compact_node() {
+		assert(next == nullptr && other == nullptr);
+		--count;
+	}
+
+	template<class Tracer>
+	void trace(Tracer& t) {
+		t(next);
+		t(other);
+	}
+};
+
+int compact_node::count = 0;
+
+struct odd_tag { };
+
+struct odd_node {
+	static int count;
+
+	int v;
+	compressed_ptr<odd_node, odd_tag> next;
+	char payload[32];
+
+	odd_node(int value = 0) : v{ value } { ++count; }
+	~odd_node() { --count; }
+
+	template<class Tracer>
+	void trace(Tracer& t) {
+		t(next);
+	}
+};
+
+int odd_node::count = 0;
+
+void test_compressed_ptr() {
+	static_assert(sizeof(odd_node) == 40, "odd_node is not a power of two");
+
+	static_assert(sizeof(compressed_ptr<compact_node, compact_tag>) == 4,
+		"a compressed_ptr is 32 bits");
+	static_assert(sizeof(compact_node) == 12,
+		"a node with two compressed_ptrs is smaller than one with two tagged_ptrs");
+
+	{
+		tagged_heap<compact_tag> heap(std::size_t{ 1 } << 30);
+
+		//	a reachable chain and unreachable cycles, as in test_tagged_heap
+		tagged_root<compact_node, compact_tag> head = heap.make<compact_node>(0);
+		auto last = head.get();
+		for (auto i = 1; i < 1000; ++i) {
+			last->next = heap.make<compact_node>(i);
+			last = last->next.get();
+		}
+		for (auto i = 0; i < 1000; ++i) {
+			auto a = heap.make<compact_node>(-1);
+			a->next = heap.make<compact_node>(-1);
+			a->next->next = a;
+		}
+		assert(compact_node::count == 3000);
+
+		heap.collect();
+		assert(compact_node::count == 1000);
+
+		auto i = 0;
+		for (auto p = head.get(); p != nullptr; p = p->next.get()) {
+			assert(p->v == i++);
+		}
+		assert(i == 1000);
+
+		//	compressing and decompressing round-trips
+		tagged_ptr<compact_node, compact_tag> t = head->next;
+		compressed_ptr<compact_node, compact_tag> c = t;
+		assert(c == head->next && c.get() == t.get() && c->v == 1);
+		c = nullptr;
+		assert(!c && !head->other);
+
+		//	pages emptied by a collection are decommitted, and their addresses
+		//	are reused for new pages
+		head = nullptr;
+		heap.collect();
+		assert(compact_node::count == 0 && heap.heap_bytes() == 0);
+
+		head = heap.make<compact_node>(0);
+		for (auto i = 1; i < 1000; ++i) {
+			auto n = heap.make<compact_node>(i);
+			n->next = head->next;
+			head->next = n;
+		}
+		heap.collect();
+		assert(compact_node::count == 1000);
+
+		head->other = head->next->next;
+		head->next->other = heap.make_array<compact_node>(10);
+		heap.collect();
+		assert(compact_node::count == 1010);
+	}
+	assert(compact_node::count == 0);
+
+	//	a page of a size that is not a multiple of the OS page size is
+	//	committed in whole locations, and decommitting it when it empties
+	//	leaves the next page intact
+	{
+		tagged_heap<odd_tag> heap(std::size_t{ 1 } << 30);
+
+		std::vector<tagged_root<odd_node, odd_tag>> roots;
+		for (auto i = 0; i < 2000; ++i) {
+			roots.push_back(heap.make<odd_node>(i));
+		}
+		roots.erase(roots.begin(), roots.begin() + 153);
+		heap.collect();
+		assert(odd_node::count == 2000 - 153);
+
+		auto i = 153;
+		for (auto& r : roots) {
+			assert(r->v == i++ && r->next == nullptr);
+		}
+	}
+	assert(odd_node::count == 0);
+}
+
+//	Memory and time for a trie with four children per node, built with
+//	tagged_ptrs and with compressed_ptrs
+//
+struct wide_trie_tag { };
+struct compact_trie_tag { };
+
+template<template<class, class> class Ptr, class Tag>
+struct trie_node {
+	Ptr<trie_node, Tag> child[4];
+	int value = 0;
+
+	template<class Tracer>
+	void trace(Tracer& t) {
+		for (auto& c : child) {
+			t(c);
+		}
+	}
+};
+
+template<template<class, class> class Ptr, class Tag>
+void time_trie(tagged_heap<Tag>& heap, const char* name) {
+	const int N = 200000, Depth = 12;
+
+	using node = trie_node<Ptr, Tag>;
+	auto start = std::chrono::high_resolution_clock::now();
+	tagged_root<node, Tag> root = heap.template make<node>();
+	auto r = 1u;
+	for (auto i = 0; i < N; ++i) {
+		auto n = root.get();
+		for (auto d = 0; d < Depth; ++d) {
+			r = r * 1103515245 + 12345;
+			auto& c = n->child[(r >> 16) % 4];
+			if (!c) {
+				c = heap.template make<node>();
+			}
+			n = c.get();
+		}
+		n->value = i;
+	}
+	auto mid = std::chrono::high_resolution_clock::now();
+	heap.collect();
+	auto end = std::chrono::high_resolution_clock::now();
+
+	cout << name << " trie (" << sizeof(node) << " bytes per node): "
+		<< heap.heap_bytes() / 1024 << "KB, "
+		<< std::chrono::duration<double, std::milli>(mid - start).count() << "ms to build, "
+		<< std::chrono::duration<double, std::milli>(end - mid).count() << "ms to collect\n";
+}
+
+void time_compressed_ptr() {
+	{
+		tagged_heap<wide_trie_tag> heap;
+		time_trie<tagged_ptr>(heap, "tagged_ptr    ");
+	}
+	{
+		tagged_heap<compact_trie_tag> heap(std::size_t{ 1 } << 32);
+		time_trie<compressed_ptr>(heap, "compressed_ptr");
+	}
+}
+
+
+//----------------------------------------------------------------------------
+//
+//	Pointer-free allocations, which marking never scans.
+//
+//----------------------------------------------------------------------------
+
+//	Not trivially copyable, but declared pointer-free below
+struct samples {
+	static int count;
+
+	vector<double> values;
+
+	samples() { ++count; }
+	samples(const samples& that) : values{ that.values } { ++count; }
+	~samples() { --count; }
+};
+
+int samples::count = 0;
+
+namespace gcpp {
+	template<>
+	struct is_pointer_free<samples> : std::true_type { };
+}
+
+struct sampled_node {
+	deferred_ptr<double>	  buffer;
+	deferred_ptr<samples>	  data;
+	deferred_ptr<sampled_node> next;
+};
+
+void test_pointer_free() {
+	static_assert(is_pointer_free<int>::value && is_pointer_free<std::array<double, 4>>::value
+		&& !is_pointer_free<deferred_ptr<int>>::value && !is_pointer_free<sampled_node>::value,
+		"trivially copyable types are pointer-free, and types with deferred_ptrs are not");
+
+	deferred_heap heap;
+	{
+		//	roots to pointer-free allocations mark them without any scanning,
+		//	so the first step of a cycle finishes it
+		vector<deferred_ptr<int>> arrays;
+		for (auto i = 0; i < 100; ++i) {
+			arrays.push_back(heap.make_array<int>(1000));
+			arrays.back()[999] = i;
+		}
+		assert(heap.collect_step(collect_budget::of_objects(1)));
+
+		//	pointer-free allocations reachable through other objects survive,
+		//	and the rest are collected
+		auto head = heap.make<sampled_node>();
+		for (auto i = 0; i < 100; ++i) {
+			auto n = heap.make<sampled_node>();
+			n->buffer = heap.make_array<double>(100);
+			n->buffer[99] = i;
+			n->data = heap.make<samples>();
+			n->data->values.assign(10, double(i));
+			n->next = head->next;
+			head->next = n;
+			heap.make<samples>();
+		}
+		assert(samples::count == 200);
+		arrays.clear();
+		heap.collect();
+		assert(samples::count == 100);
+
+		auto i = 100;
+		for (auto n = head->next; n; n = n->next) {
+			--i;
+			assert(n->buffer[99] == i && n->data->values.back() == i);
+		}
+		assert(i == 0);
+
+		head = nullptr;
+		heap.collect();
+		assert(samples::count == 0 && heap.heap_bytes() == 0);
+	}
+}
+
+//	Time to collect a heap of nodes that each own a large numeric buffer,
+//	with the buffers on pointer-free pages and with them on ordinary pages
+//
+struct opaque_double {
+	double d = 0;
+
+	opaque_double() = default;
+	opaque_double(const opaque_double& that) : d{ that.d } { }
+};
+
+template<class Number>
+void time_buffers(const char* name) {
+	const int N = 1000, Size = 10000;
+
+	struct buffer_node {
+		deferred_ptr<Number> buffer;
+		deferred_ptr<buffer_node> next;
+	};
+
+	deferred_heap heap;
+	auto head = heap.make<buffer_node>();
+	for (auto i = 0; i < N; ++i) {
+		auto n = heap.make<buffer_node>();
+		n->buffer = heap.make_array<Number>(Size);
+		n->next = head->next;
+		head->next = n;
+	}
+	heap.collect();
+
+	auto start = std::chrono::high_resolution_clock::now();
+	heap.collect();
+	auto end = std::chrono::high_resolution_clock::now();
+	cout << name << ": " << N << " nodes with " << Size << "-element buffers, "
+		<< std::chrono::duration<double, std::milli>(end - start).count() << "ms to collect\n";
+}
+
+void time_pointer_free() {
+	time_buffers<double>("pointer-free buffers");
+	time_buffers<opaque_double>("scanned buffers     ");
+}
+
+
+//----------------------------------------------------------------------------
+//
+//	Types with a deferred_layout, whose deferred_ptrs are not registered.
+//
+//----------------------------------------------------------------------------
+
+struct laid_out_node {
+	static int count;
+
+	long v;
+	deferred_ptr<laid_out_node> next;
+	deferred_ptr<laid_out_node> other;
+
+	laid_out_node(long value = 0) : v{ value } { ++count; }
+	laid_out_node(laid_out_node&& that) : v{ that.v }, next{ std::move(that.next) }, other{ std::move(that.other) } { ++count; }
+	~laid_out_node() {
+		assert(!next || next->v != -2);	// unreachable targets are reset first
+		--count;
+	}
+};
+
+int laid_out_node::count = 0;
+
+namespace gcpp {
+	template<>
+	struct deferred_layout<laid_out_node> : std::true_type {
+		static std::vector<std::size_t> offsets() {
+			return{ offsetof(laid_out_node, next), offsetof(laid_out_node, other) };
+		}
+	};
+
+	template<>
+	struct is_relocatable<laid_out_node> : std::true_type { };
+}
+
+void test_deferred_layout() {
+	deferred_heap heap;
+	{
+		//	a reachable chain, and unreachable cycles
+		auto head = heap.make<laid_out_node>(0);
+		auto last = head;
+		for (auto i = 1; i < 1000; ++i) {
+			last->next = heap.make<laid_out_node>(i);
+			last = last->next;
+		}
+		last = nullptr;
+		for (auto i = 0; i < 1000; ++i) {
+			auto a = heap.make<laid_out_node>(-2);
+			a->next = heap.make<laid_out_node>(-2);
+			a->next->next = a;
+			a->other = head;
+		}
+		assert(laid_out_node::count == 3000);
+
+		//	incrementally too, with the program changing pointers between steps
+		heap.collect_step(collect_budget::of_objects(1));
+		head->other = heap.make<laid_out_node>(-1);
+		head->other->next = head->next->next;
+		head->next->next = nullptr;
+		heap.collect();
+		assert(laid_out_node::count == 1001);
+		head->next->next = head->other->next;
+		head->other = nullptr;
+		heap.collect();
+		assert(laid_out_node::count == 1000);
+
+		auto i = 0;
+		for (auto p = head; p; p = p->next) {
+			assert(p->v == i++);
+		}
+		assert(i == 1000);
+
+		//	in containers, whose elements move when they grow, and in arrays
+		auto arr = heap.make_array<laid_out_node>(10);
+		arr[9].other = heap.make<laid_out_node>(-1);
+		{
+			deferred_vector<laid_out_node> v(heap);
+			for (auto i = 0; i < 100; ++i) {
+				v.emplace_back(i);
+				v.back().next = head;
+			}
+			head = nullptr;
+			heap.collect();
+			assert(laid_out_node::count == 1000 + 100 + 11);
+		}
+
+		//	compaction moves laid-out objects only to pages of the same type
+		heap.collect();
+		heap.compact(1.0);
+		assert(laid_out_node::count == 11 && arr[9].other->v == -1);
+	}
+	heap.collect();
+	assert(laid_out_node::count == 0);
+}
+
+//	Time to build and collect a graph of nodes with four pointers each, with
+//	registered deferred_ptrs and with a deferred_layout
+//
+struct laid_out_fan {
+	deferred_ptr<laid_out_fan> next[4];
+};
+
+namespace gcpp {
+	template<>
+	struct deferred_layout<laid_out_fan> : std::true_type {
+		static std::vector<std::size_t> offsets() {
+			std::vector<std::size_t> ret;
+			for (auto i = 0; i < 4; ++i) {
+				ret.push_back(offsetof(laid_out_fan, next) + i * sizeof(deferred_ptr<laid_out_fan>));
+			}
+			return ret;
+		}
+	};
+}
+
+template<class Node>
+void time_fan(const char* name, bool conservative = false) {
+	const int N = 200000;
+
+	deferred_heap heap;
+	heap.set_conservative_scan(conservative);
+	vector<deferred_ptr<Node>> nodes;
+	nodes.reserve(N);
+
+	for (auto i = 0; i < N; ++i) {
+		nodes.push_back(heap.make<Node>());
+	}
+
+	//	the first store to each in-heap deferred_ptr attaches it to the heap
+	auto start = std::chrono::high_resolution_clock::now();
+	auto r = 1u;
+	for (auto i = 0; i < N; ++i) {
+		for (auto& p : nodes[i]->next) {
+			r = r * 1103515245 + 12345;
+			p = nodes[r % N];
+		}
+	}
+	auto mid = std::chrono::high_resolution_clock::now();
+	auto root = nodes[0];
+	nodes.clear();
+	heap.collect();
+	auto end = std::chrono::high_resolution_clock::now();
+
+	cout << name << ": " << std::chrono::duration<double, std::milli>(mid - start).count()
+		<< "ms to link " << 4 * N << " pointers, " << std::chrono::duration<double, std::milli>(end - mid).count()
+		<< "ms to collect\n";
+}
+
+void time_deferred_layout() {
+	time_fan<fan_node>("registered deferred_ptrs");
+	time_fan<laid_out_fan>("deferred_layout         ");
+}
+
+
+//----------------------------------------------------------------------------
+//
+//	Conservative scanning, which finds in-heap pointers, raw or not, by
+//	scanning every word of the reached objects.
+//
+//----------------------------------------------------------------------------
+
+struct conservative_node {
+	static int count;
+
+	long v;
+	deferred_ptr<conservative_node> next;
+	conservative_node* raw = nullptr;
+
+	conservative_node(long value = 0) : v{ value } { ++count; }
+	~conservative_node() {
+		assert(!next || next->v != -2);	// unreachable targets are reset first
+		--count;
+	}
+};
+
+int conservative_node::count = 0;
+
+void test_conservative_scan() {
+	deferred_heap heap;
+	heap.set_conservative_scan(true);
+	{
+		//	a reachable chain, and unreachable cycles
+		auto head = heap.make<conservative_node>(0);
+		auto last = head;
+		for (auto i = 1; i < 1000; ++i) {
+			last->next = heap.make<conservative_node>(i);
+			last = last->next;
+		}
+		last = nullptr;
+		for (auto i = 0; i < 1000; ++i) {
+			auto a = heap.make<conservative_node>(-2);
+			a->next = heap.make<conservative_node>(-2);
+			a->next->next = a;
+			a->raw = head.get();
+		}
+		assert(conservative_node::count == 3000);
+
+		//	each step completes its cycle
+		assert(heap.collect_step(collect_budget::of_objects(1)));
+		assert(conservative_node::count == 1000);
+
+		//	raw pointers keep their targets alive too, even into the middle
+		//	of an allocation
+		head->raw = heap.make<conservative_node>(-1).get();
+		auto arr = heap.make_array<long>(100);
+		arr[50] = 42;
+		head->next->raw = reinterpret_cast<conservative_node*>(arr.get() + 50);
+		arr = nullptr;
+		heap.collect();
+		assert(conservative_node::count == 1001 && head->raw->v == -1);
+		assert(*reinterpret_cast<long*>(head->next->raw) == 42);
+
+		head->raw = nullptr;
+		head->next->raw = nullptr;
+		heap.collect();
+		assert(conservative_node::count == 1000);
+
+		auto i = 0;
+		for (auto p = head; p; p = p->next) {
+			assert(p->v == i++);
+		}
+		assert(i == 1000);
+
+		//	in containers, even of trivially copyable elements
+		{
+			deferred_vector<conservative_node*> v(heap);
+			for (auto i = 0; i < 100; ++i) {
+				v.push_back(heap.make<conservative_node>(i).get());
+				v.back()->next = head;
+			}
+			head = nullptr;
+			heap.collect();
+			assert(conservative_node::count == 1100);
+			i = 0;
+			for (auto n : v) {
+				assert(n->v == i++ && n->next->v == 0);
+			}
+		}
+
+		//	a minor cycle scans the old pages for pointers into the nursery
+		heap.collect();
+		assert(conservative_node::count == 0);
+		heap.set_generational(true);
+		auto old = heap.make<conservative_node>(0);
+		heap.collect_minor();
+		old->raw = heap.make<conservative_node>(1).get();
+		heap.collect_minor();
+		assert(conservative_node::count == 2 && old->raw->v == 1);
+
+		//	and compaction moves nothing
+		auto before = old.get();
+		heap.compact(1.0);
+		assert(old.get() == before && old->raw->v == 1);
+		old->raw = nullptr;
+	}
+	heap.collect();
+	assert(conservative_node::count == 0 && heap.heap_bytes() == 0);
+
+	//	a background collector can only run while conservative scanning is
+	//	off, and conservative scanning can only be turned on while it isn't
+	heap.set_conservative_scan(false);
+	heap.set_background_collector(true);
+	assert(heap.get_background_collector() && !heap.get_conservative_scan());
+	heap.set_background_collector(false);
+	heap.set_conservative_scan(true);
+	assert(!heap.get_background_collector() && heap.get_conservative_scan());
+}
+
+//	Time to link and collect nodes with four pointers each (pointer-dense)
+//	and with one pointer and a numeric payload each (pointer-sparse), with
+//	registered deferred_ptrs and with conservative scanning
+//
+struct sparse_node {
+	double payload[31];
+	deferred_ptr<sparse_node> next[1];
+
+	sparse_node() {
+		for (auto i = 0; i < 31; ++i) {
+			payload[i] = i * 0.25;
+		}
+	}
+};
+
+void time_conservative_scan() {
+	time_fan<fan_node>("dense,  registered  ");
+	time_fan<fan_node>("dense,  conservative", true);
+	time_fan<sparse_node>("sparse, registered  ");
+	time_fan<sparse_node>("sparse, conservative", true);
+}
+
+
+//----------------------------------------------------------------------------
+//
+//	Resetting a heap, to use it as a region per request.
+//
+//----------------------------------------------------------------------------
+
+void test_reset() {
+	deferred_heap heap;
+	{
+		//	a reachable graph with cycles, unreachable cycles, arrays, and roots
+		//	in and out of root vectors
+		deferred_root_vector<counted_node> v(heap);
+		auto head = heap.make<counted_node>(0);
+		for (auto i = 1; i < 100; ++i) {
+			auto n = heap.make<counted_node>(i);
+			n->next = head;
+			n->other = n;
+			head = n;
+			v.push_back(heap.make<counted_node>(-1));
+			v.back()->next = head;
+		}
+		auto numbers = heap.make_array<int>(1000);
+		auto a = heap.make<laid_out_node>(-2);
+		a->next = heap.make<laid_out_node>(-2);
+		a->next->next = a;
+		assert(counted_node::count == 199 && laid_out_node::count == 2);
+
+		//	everything is destroyed, the pointers are null, and the pages stay
+		auto bytes = heap.heap_bytes();
+		heap.reset();
+		assert(counted_node::count == 0 && laid_out_node::count == 0);
+		assert(!head && !numbers && !a && v.empty());
+		assert(heap.heap_bytes() == bytes && heap.fragmentation() == 1);
+
+		//	and the heap is ready for the next request, on the same pages
+		head = heap.make<counted_node>(1);
+		head->next = heap.make<counted_node>(2);
+		v.push_back(head->next);
+		numbers = heap.make_array<int>(1000);
+		numbers[999] = 3;
+		assert(heap.heap_bytes() == bytes);
+		heap.collect();
+		assert(counted_node::count == 2 && v[0]->v == 2 && numbers[999] == 3);
+
+		//	in the middle of an incremental cycle too
+		heap.collect_step(collect_budget::of_objects(1));
+		heap.reset();
+		assert(counted_node::count == 0 && !head && v.empty());
+		head = heap.make<counted_node>(1);
+		heap.collect();
+		assert(counted_node::count == 1 && head->v == 1);
+	}
+	heap.collect();
+	assert(counted_node::count == 0);
+}
+
+//	Time to serve requests that each build a graph and then discard it all,
+//	with a heap per request, one heap collected after each request, and one
+//	heap reset after each request
+//
+template<class Discard>
+void time_requests(const char* name, std::unique_ptr<deferred_heap>& heap, Discard discard) {
+	const int Requests = 100, N = 10000;
+
+	auto start = std::chrono::high_resolution_clock::now();
+	std::chrono::high_resolution_clock::duration discarding{};
+	for (auto r = 0; r < Requests; ++r) {
+		auto head = heap->make<counted_node>(0);
+		for (auto i = 1; i < N; ++i) {
+			auto n = heap->make<counted_node>(i);
+			n->next = head;
+			head = n;
+		}
+		auto mid = std::chrono::high_resolution_clock::now();
+		discard(head);
+		discarding += std::chrono::high_resolution_clock::now() - mid;
+	}
+	auto end = std::chrono::high_resolution_clock::now();
+
+	cout << name << ": " << Requests << " requests of " << N << " nodes, "
+		<< std::chrono::duration<double, std::milli>(end - start).count() << "ms in total, "
+		<< std::chrono::duration<double, std::milli>(discarding).count() << "ms to discard\n";
+}
+
+void time_reset() {
+	auto heap = std::make_unique<deferred_heap>();
+	time_requests("heap per request", heap, [&](deferred_ptr<counted_node>&) {
+		heap = std::make_unique<deferred_heap>();
+	});
+	time_requests("collect         ", heap, [&](deferred_ptr<counted_node>& head) {
+		head = nullptr;
+		heap->collect();
+	});
+	time_requests("reset           ", heap, [&](deferred_ptr<counted_node>&) {
+		heap->reset();
+	});
+}
+
+
+//----------------------------------------------------------------------------
+//
+//	Adopting one heap's objects into another.
+//
+//----------------------------------------------------------------------------
+
+void test_adopt() {
+	deferred_heap shared;
+	auto kept = shared.make<counted_node>(-1);
+	{
+		//	a graph built by a worker in a private heap, with a cycle, a
+		//	root vector, an array, and laid-out objects
+		deferred_heap worker;
+		deferred_root_vector<counted_node> v(worker);
+		deferred_ptr<counted_node> head;
+		deferred_ptr<int> numbers;
+		deferred_ptr<laid_out_node> a;
+		std::thread{ [&] {
+			head = worker.make<counted_node>(0);
+			for (auto i = 1; i < 100; ++i) {
+				auto n = worker.make<counted_node>(i);
+				n->next = head;
+				head = n;
+			}
+			head->other = head;
+			v.push_back(head->next);
+			numbers = worker.make_array<int>(1000);
+			numbers[999] = 3;
+			a = worker.make<laid_out_node>(1);
+			a->next = worker.make<laid_out_node>(2);
+		} }.join();
+		auto bytes = worker.heap_bytes() + shared.heap_bytes();
+
+		//	everything moves, and the pointers now point into the other heap
+		shared.adopt(std::move(worker));
+		assert(worker.heap_bytes() == 0 && shared.heap_bytes() == bytes);
+		assert(head.get_heap() == &shared && numbers.get_heap() == &shared
+			&& a->next.get_heap() == &shared && v.get_heap() == &shared);
+		assert(counted_node::count == 101 && laid_out_node::count == 2);
+
+		//	the adopted objects can point to the heap's own, and vice versa
+		kept->next = head;
+		head->next->other = kept;
+		head = nullptr;
+		shared.collect();
+		assert(counted_node::count == 101 && v[0]->v == 98 && numbers[999] == 3
+			&& a->next->v == 2 && kept->next->next->v == 98);
+
+		//	and both heaps go on as usual
+		kept->next = nullptr;
+		v.clear();
+		numbers = nullptr;
+		a = nullptr;
+		shared.collect();
+		assert(counted_node::count == 1 && laid_out_node::count == 0);
+		auto n = worker.make<counted_node>(1);
+		worker.collect();
+		assert(counted_node::count == 2);
+	}
+	assert(counted_node::count == 1);
+	kept = nullptr;
+	shared.collect();
+	assert(counted_node::count == 0 && shared.heap_bytes() == 0);
+
+	//	a container built on the worker follows its objects, also when the
+	//	heap that adopted them is adopted in turn
+	{
+		deferred_heap worker, outer;
+		deferred_vector<deferred_ptr<counted_node>> v(worker);
+		for (auto i = 0; i < 100; ++i) {
+			v.push_back(worker.make<counted_node>(i));
+		}
+
+		shared.adopt(std::move(worker));
+		assert(&v.get_allocator().heap() == &shared && worker.heap_bytes() == 0);
+		for (auto i = 100; i < 1000; ++i) {
+			v.push_back(shared.make<counted_node>(i));
+		}
+		assert(worker.heap_bytes() == 0 && v[999]->v == 999);
+
+		outer.adopt(std::move(shared));
+		assert(&v.get_allocator().heap() == &outer && shared.heap_bytes() == 0);
+		v.push_back(outer.make<counted_node>(1000));
+		assert(shared.heap_bytes() == 0 && v.back()->v == 1000);
+
+		//	while new containers on the adopted heaps use those heaps
+		deferred_vector<int> w(worker);
+		w.push_back(1);
+		assert(&w.get_allocator().heap() == &worker && worker.heap_bytes() > 0);
+		v.clear();
+		v.shrink_to_fit();
+		outer.collect();
+		assert(counted_node::count == 0);
+	}
+}
+
+//	Time to hand a graph built in a private heap to a shared heap, by copying
+//	it and by adopting the private heap
+//
+void time_adopt() {
+	const int N = 100000;
+
+	auto build = [&](deferred_heap& heap) {
+		auto head = heap.make<counted_node>(0);
+		for (auto i = 1; i < N; ++i) {
+			auto n = heap.make<counted_node>(i);
+			n->next = head;
+			head = n;
+		}
+		return head;
+	};
+
+	{
+		deferred_heap shared, worker;
+		auto head = build(worker);
+		auto start = std::chrono::high_resolution_clock::now();
+		auto copy = shared.make<counted_node>(head->v);
+		auto last = copy;
+		for (auto p = head->next; p; p = p->next) {
+			last->next = shared.make<counted_node>(p->v);
+			last = last->next;
+		}
+		auto end = std::chrono::high_resolution_clock::now();
+		cout << "copy : " << std::chrono::duration<double, std::milli>(end - start).count()
+			<< "ms to hand over " << N << " nodes\n";
+	}
+	{
+		deferred_heap shared, worker;
+		auto head = build(worker);
+		auto start = std::chrono::high_resolution_clock::now();
+		shared.adopt(std::move(worker));
+		auto end = std::chrono::high_resolution_clock::now();
+		cout << "adopt: " << std::chrono::duration<double, std::milli>(end - start).count()
+			<< "ms to hand over " << N << " nodes\n";
+	}
+}
+
+
+//----------------------------------------------------------------------------
+//
+//	Releasing allocations eagerly, and containers' deallocated storage.
+//
+//----------------------------------------------------------------------------
+
+struct counted_element {
+	static int count;
+
+	int v;
+
+	counted_element(int value) : v{ value } { ++count; }
+	counted_element(const counted_element& that) : v{ that.v } { ++count; }
+	~counted_element() { --count; }
+};
+
+int counted_element::count = 0;
+
+void test_release() {
+	deferred_heap heap;
+	{
+		//	an allocation that nothing refers to is released right away...
+		auto raw = heap.make<counted_node>(1).get();
+		assert(counted_node::count == 1 && heap.release(raw) && counted_node::count == 0);
+
+		//	... but not one that a root, or a deferred_ptr on its own or on
+		//	another page, refers to
+		auto n = heap.make<counted_node>(2);
+		assert(!heap.release(n.get()));
+		auto m = heap.make<counted_node>(3);
+		m->next = n;
+		raw = n.get();
+		n = nullptr;
+		assert(!heap.release(raw));
+		auto arr = heap.make_array<counted_node>(10);
+		arr[5].other = m;
+		raw = m.get();
+		m = nullptr;
+		assert(!heap.release(raw) && !heap.release(arr.get() + 5));
+
+		//	its own deferred_ptrs don't count, and are reset first
+		raw = arr.get() + 5;
+		arr[5].other->next = nullptr;
+		arr[0].other = heap.make<counted_node>(4);
+		arr[0].other->next = arr[0].other;
+		arr = nullptr;
+		assert(counted_node::count == 13 && heap.release(raw) && counted_node::count == 3);
+
+		//	nor is anything released during a cycle
+		auto last = heap.make<counted_node>(5);
+		heap.collect_step(collect_budget::of_objects(1));
+		raw = last.get();
+		last = nullptr;
+		assert(!heap.release(raw));
+		heap.collect();
+		assert(counted_node::count == 0);
+
+		//	a vector's outgrown storage is released at the next allocation,
+		//	with the old copies of its elements
+		deferred_vector<counted_element> v(heap);
+		for (auto i = 0; i < 100; ++i) {
+			v.emplace_back(i);
+		}
+		assert(counted_element::count > 100);
+		heap.make<int>();
+		assert(counted_element::count == 100 && v[99].v == 99);
+
+		//	but not while something still refers to it
+		auto first = v.begin();
+		v.reserve(1000);
+		heap.make<int>();
+		assert(counted_element::count == 200 && first->v == 0);
+	}
+	heap.collect();
+	assert(counted_element::count == 0 && heap.heap_bytes() == 0);
+
+	//	while the remembered sets are kept, a reference from another page
+	//	is found through them
+	heap.set_region_collection(true);
+	{
+		auto n = heap.make<counted_node>(1);
+		auto arr = heap.make_array<counted_node>(10);
+		arr[5].other = n;
+		auto raw = n.get();
+		n = nullptr;
+		assert(!heap.release(raw));
+		arr[5].other = nullptr;
+		assert(heap.release(raw) && counted_node::count == 10);
+	}
+	heap.collect();
+	assert(counted_node::count == 0);
+}
+
+//	Time to churn a vector, and how much the heap grows
+//
+void time_release() {
+	const int Rounds = 1000, N = 1000;
+
+	deferred_heap heap;
+	auto start = std::chrono::high_resolution_clock::now();
+	for (auto r = 0; r < Rounds; ++r) {
+		deferred_vector<int> v(heap);
+		for (auto i = 0; i < N; ++i) {
+			v.push_back(i);
+		}
+	}
+	auto end = std::chrono::high_resolution_clock::now();
+
+	cout << Rounds << " vectors of " << N << " ints: "
+		<< std::chrono::duration<double, std::milli>(end - start).count() << "ms, heap of "
+		<< heap.heap_bytes() / 1024 << "KB\n";
+}
+
+
+void test_bitflags() {
+	const int N = 100;	// picked so that we have 3 x 32-bit units + 1 partial unit,
+						// so we can exercise the boundary and internal unit cases
+
+	//	Test that we can correctly set any bit range [i,j)
+	for (auto i = 0; i < N; ++i) {
+		for (auto j = i; j < N; ++j) {
+			bitflags flags(100, false);
+			flags.set(i, j, true);
+			for (auto test = 0; test < N; ++test) {
+				assert(flags.get(test) == (i <= test && test < j));
+			}
+		}
+	}
+
+	//	Test that we can find a true bit set anywhere with any range
+	for (auto set = 0; set < N; ++set) {
+		bitflags flags(100, false);
+		flags.set(set, true);
+		for (auto i = 0; i <= set; ++i) {
+			for (auto j = i; j < N; ++j) {
+				assert(flags.find_next(i, j, true) == min(j,set));
+			}
+		}
+	}
+
+	//	Test that we can find a false bit set anywhere with any range
+	for (auto set = 0; set < N; ++set) {
+		bitflags flags(100, true);
+		flags.set(set, false);
+		for (auto i = 0; i <= set; ++i) {
+			for (auto j = i; j < N; ++j) {
+				assert(flags.find_next(i, j, false) == min(j, set));
+			}
+		}
+	}
+
+	//	Test that we count and detect set bits in every unit, including the last
+	for (auto size : { 32, 64, 100 }) {
+		for (auto set = 0; set < size; ++set) {
+			bitflags flags(size, false);
+			assert(flags.all_false() && flags.count() == 0);
+			flags.set(set, true);
+			assert(!flags.all_false() && flags.count() == 1);
+			flags.set(0, size, true);
+			assert(flags.count() == size);
+		}
+	}
+
+	//flags.debug_print();
+}
+
+
+int main() {
+	//test_page();
+	//test_bitflags();
+
+	//test_deferred_heap();
+	//time_deferred_heap();
+
+	//test_deferred_allocator();
+
+	//test_deferred_allocator_set();
+	//time_deferred_allocator_set();
+
+	test_deferred_allocator_vector();
+	//time_deferred_allocator_vector();
+
+	//test_deferred_array();
+
+	test_collect_step();
+	//time_collect_step();
+
+	test_background_collector();
+	//time_background_collector();
+
+	test_generational();
+	//time_generational();
+
+	test_collect_regions();
+	//time_collect_regions();
+	//time_remembered_sets();
+
+	test_lazy_sweep();
+	//time_lazy_sweep();
+
+	test_compact();
+	//time_compact();
+
+	test_pacer();
+	//time_pacer();
+
+	test_page_retention();
+	//time_page_retention();
+
+	test_array_destructors();
+	//time_array_destructors();
+	//time_destructors();
+	//time_sweep_batching();
+
+	test_deferred_finalization();
+	//time_deferred_finalization();
+
+	test_tagged_heap();
+	//time_tagged_heap();
+
+	test_deferred_ptr_move();
+	//time_deferred_ptr_sort();
+
+	test_array_deferred_ptr();
+	//time_array_deferred_ptr();
+
+	test_thread_safe_heap();
+	//time_thread_safe_heap();
+
+	test_deferred_root_vector();
+	//time_deferred_root_vector();
+
+	test_pointer_index();
+	//time_pointer_index();
+
+	test_compressed_ptr();
+	//time_compressed_ptr();
+
+	test_pointer_free();
+	//time_pointer_free();
+
+	test_deferred_layout();
+	//time_deferred_layout();
+
+	test_conservative_scan();
+	//time_conservative_scan();
+
+	test_reset();
+	//time_reset();
+
+	test_adopt();
+	//time_adopt();
+
+	test_release();
+	//time_release();
 
 	//heap.collect();
 	//heap.debug_print();